@@ -1,19 +1,44 @@
 #version 410
 
-uniform mat4 u_mvp;
+// shared with postprocess.ps, mirrored by FrameUniforms in main.c
+layout( std140 ) uniform Frame
+{
+	mat4 u_mvp;
+	float u_time;
+	float u_timeFraction;
+};
 
 in vec4 a_pos;
 in vec4 a_col;
 in vec4 a_normal;
 
+// per-instance
+in vec3 a_offset;
+in vec3 a_scale;
+in vec4 a_rotation;
+
 out vec4 v_pos;
 out vec4 v_col;
-out vec4 v_normal;
+
+// Meshes are lit per face. The CPU wave loads this shader with SMOOTH_NORMALS
+// defined to interpolate its shared vertex normals instead, see InitWaveRender.
+#ifdef SMOOTH_NORMALS
+	out vec4 v_normal;
+#else
+	flat out vec4 v_normal;
+#endif
+
+vec3 Rotate( vec4 q, vec3 v )
+{
+	return v + 2.0 * cross( q.xyz, cross( q.xyz, v ) + q.w * v );
+}
 
 void main( )
 {
+	vec3 pos = Rotate( a_rotation, a_pos.xyz ) * a_scale + a_offset;
+	vec3 normal = normalize( Rotate( a_rotation, a_normal.xyz ) / a_scale );
 	v_col = a_col;
-	v_normal = u_mvp * vec4( a_normal.x, a_normal.y, a_normal.z, 0 );
-	v_pos = u_mvp * a_pos;
+	v_normal = u_mvp * vec4( normal, 0 );
+	v_pos = u_mvp * vec4( pos, 1 );
 	gl_Position = v_pos;
 }
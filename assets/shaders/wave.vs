@@ -0,0 +1,63 @@
+#version 410
+
+// shared with postprocess.ps, mirrored by FrameUniforms in main.c
+layout( std140 ) uniform Frame
+{
+	mat4 u_mvp;
+	float u_time;
+	float u_timeFraction;
+};
+
+// r height of each particle, see wave_sim.ps
+uniform sampler2D u_state;
+
+// WAVE_W, WAVE_H, and the cell the grid is centered on
+uniform vec4 u_grid;
+uniform vec3 u_scale;
+
+// WAVE_OFFSET_* with the current height variance added to y
+uniform vec3 u_offset;
+
+uniform vec3 u_player;
+
+// initialWaveY - WAVE_OFFSET_Y and WAVE_OFFSET_Y * 2, for the color ramp
+uniform vec2 u_colorRamp;
+
+in vec2 a_cell;
+
+out vec4 v_col;
+out vec4 v_normal;
+
+float Height( int x, int y )
+{
+	return texelFetch( u_state, ivec2( x, y ), 0 ).r * u_scale.y;
+}
+
+// mirrors DrawWaveJob in main.c
+vec3 WaveNormal( ivec2 cell )
+{
+	ivec2 lo = max( cell - 1, ivec2( 0 ) );
+	ivec2 hi = min( cell + 1, ivec2( u_grid.xy ) );
+	float dx = (Height( hi.x, cell.y ) - Height( lo.x, cell.y )) / (float( hi.x - lo.x ) * u_scale.x);
+	float dz = (Height( cell.x, hi.y ) - Height( cell.x, lo.y )) / (float( hi.y - lo.y ) * u_scale.z);
+	return normalize( vec3( -dx, 1, -dz ) );
+}
+
+// mirrors CalcWaveColor in main.c
+vec3 WaveColor( vec3 p )
+{
+	float y = (p.y - u_colorRamp.x) / u_colorRamp.y;
+	vec3 c = mix( vec3( 0.8, 0.2, 0.4 ), vec3( 0.6, 0.75, 0.95 ), y );
+	float l = length( p - u_player );
+	if ( l < 100.0 ) c = mix( vec3( 1, 0, 0 ), c, l / 100.0 );
+	return c;
+}
+
+void main( )
+{
+	ivec2 cell = ivec2( a_cell );
+	vec3 p = vec3( (a_cell.x - u_grid.z) * u_scale.x, Height( cell.x, cell.y ), (a_cell.y - u_grid.w) * u_scale.z ) + u_offset;
+	v_col = vec4( clamp( WaveColor( p ), 0, 1 ), 1 );
+	v_normal = u_mvp * vec4( WaveNormal( cell ), 0 );
+	gl_Position = u_mvp * vec4( p, 1 );
+}
@@ -0,0 +1,7 @@
+#version 410
+
+// one triangle covering the whole target, see tgRunPass
+void main( )
+{
+	gl_Position = vec4( (gl_VertexID & 1) * 4 - 1, (gl_VertexID >> 1) * 4 - 1, 0, 1 );
+}
@@ -1,5 +1,38 @@
 
-#include <Windows.h>
+// POOK_HEADLESS builds a benchmark binary for Linux boxes without a display or
+// GPU. GLFW is compiled for its OSMesa backend, which renders offscreen through
+// Mesa's software rasterizer (llvmpipe), and main runs a fixed number of frames
+// with no vsync, no sound and a fixed timestep, printing CPU and render time
+// per frame. Build from the repo root with bash, all on one line:
+//
+//   cc -O2 -DPOOK_HEADLESS -D_GLFW_OSMESA -Ideps -Ideps/lua main.c deps/glad/glad.c
+//     deps/glfw/{context,init,input,monitor,window,vulkan,osmesa_init,osmesa_monitor,osmesa_window,osmesa_context,posix_time,posix_tls}.c
+//     $(ls deps/lua/*.c | grep -v ltests) -lGLU -lm -ldl -lpthread -o pook_headless
+//
+// then run it from the repo root with a frame count (default 600), which prints
+// a CSV line per frame and a summary at the end:
+//
+//   ./pook_headless 600
+//
+// libOSMesa is loaded at runtime by GLFW, so only the run needs Mesa installed.
+#ifndef POOK_HEADLESS
+	#define POOK_HEADLESS 0
+#endif
+
+#define POOK_SOUND !POOK_HEADLESS
+
+// Records CPU scopes and per draw GPU times for the last PROFILE_FRAMES frames,
+// written out as a Chrome trace (chrome://tracing or ui.perfetto.dev) on F9 and
+// at exit. Off by default since it times every draw, build with -DPOOK_PROFILE=1
+// to turn it on. See ProfileBegin.
+#ifndef POOK_PROFILE
+	#define POOK_PROFILE 0
+#endif
+#define PROFILE_PATH "profile.json"
+
+#ifdef _WIN32
+	#include <Windows.h>
+#endif
 
 #include <glad/glad.h>
 #include <glfw/glfw_config.h>
@@ -14,10 +47,12 @@
 #define STB_VORBIS_HEADER_ONLY
 #include "stb_vorbis.c"
 
-#define TS_IMPLEMENTATION
+#if POOK_SOUND
+	#define TS_IMPLEMENTATION
+#endif
 #include "tinysound.h"
 
-#if defined(__APPLE__)
+#if defined(__APPLE__) || defined(__linux__)
 	#include <lua.h>
 	#include <lualib.h>
 	#include <lauxlib.h>
@@ -29,8 +64,30 @@
 
 #include <stdio.h>
 #include <float.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#ifdef _WIN32
+	#define stat _stat
+#endif
+
+#if defined( _M_X64 ) || defined( _M_IX86 ) || defined( __x86_64__ ) || defined( __i386__ )
+	#define POOK_X86 1
+	#include <immintrin.h>
+	#if defined( _MSC_VER )
+		#include <intrin.h>
+		#define POOK_TARGET_AVX
+	#else
+		#include <cpuid.h>
+		#define POOK_TARGET_AVX __attribute__(( target( "avx" ) ))
+	#endif
+#else
+	#define POOK_X86 0
+#endif
 
 const float GAME_DURATION = 10;
+const float NEAR_PLANE = 0.1f;
+const float FAR_PLANE = 10000.0f;
 
 GLFWwindow* window;
 
@@ -41,6 +98,19 @@ float projection[ 16 ];
 float mvp[ 16 ];
 float cam[ 16 ];
 tgShader simple;
+
+// std140 layout of the Frame uniform block in simple.vs and postprocess.ps
+typedef struct
+{
+	float mvp[ 16 ];
+	float time;
+	float time_fraction;
+	float pad[ 2 ];
+} FrameUniforms;
+
+#define FRAME_UNIFORMS_BINDING 0
+FrameUniforms frame_uniforms;
+tgUniformBlock frame_block = { &frame_uniforms, sizeof( FrameUniforms ) };
 struct Vertex;
 int mouse_moved;
 int initialWaveY = -15;
@@ -68,6 +138,8 @@ typedef struct
 	v3 p;
 } tx;
 
+// CPU side vert, what Lua pushes and what meshes keep around. The GPU reads
+// the compact StreamVertex and MeshVertex below instead.
 typedef struct
 {
 	v3 position;
@@ -75,10 +147,67 @@ typedef struct
 	v3 normal;
 } Vertex;
 
+// Streamed verts are already in world space, too far from the origin for half
+// float positions. Colors are RGBA8 and normals GL_INT_2_10_10_10_REV, 20 bytes
+// instead of 36.
+typedef struct
+{
+	v3 position;
+	uint32_t color;
+	uint32_t normal;
+} StreamVertex;
+
+// Mesh verts are in object space, so positions fit half floats, padded to four
+// for alignment. 16 bytes.
+typedef struct
+{
+	uint16_t position[ 4 ];
+	uint32_t color;
+	uint32_t normal;
+} MeshVertex;
+
+// Per-instance attributes fed to simple.vs. The rotation is a quaternion.
+typedef struct
+{
+	v3 offset;
+	v3 scale;
+	float rotation[ 4 ];
+} InstanceData;
+
+#define MESH_MAX_LODS 4
+
+// Mesh verts live once in a static VBO owned by r. Instances submitted during
+// the frame collect in instances and are drawn with one instanced draw call.
 typedef struct
 {
 	int vert_count;
 	Vertex* verts;
+
+	// SoA copies of the positions and face normals for the instance expansion
+	// kernels, padded with zeros to a multiple of EXPAND_BLOCK, and the vert
+	// colors packed for StreamVertex. One allocation owned by px.
+	int face_count;
+	float* px;
+	float* py;
+	float* pz;
+	float* nx;
+	float* ny;
+	float* nz;
+	uint32_t* colors;
+
+	// object space bounding sphere, for frustum culling instances
+	v3 bound_center;
+	float bound_radius;
+
+	// Mesh handles of each level of detail, finest first. lods[ 0 ] is this
+	// mesh, the coarser levels are meshes of their own named "<name>#lod<n>".
+	int lod_count;
+	int lods[ MESH_MAX_LODS ];
+
+	tgRenderable r;
+	int instance_count;
+	int instance_capacity;
+	InstanceData* instances;
 } Mesh;
 
 typedef struct
@@ -86,7 +215,10 @@ typedef struct
 	tgRenderable r;
 	int count;
 	int capacity;
-	Vertex* verts;
+	StreamVertex* verts;
+
+	// driver memory the expand jobs write to this frame, see ZERO_COPY_STREAMING
+	StreamVertex* mapped;
 } DrawCall;
 
 void ErrorCB( int error, const char* description )
@@ -97,18 +229,30 @@ void ErrorCB( int error, const char* description )
 void pcall_setup( const char* func_name );
 void pcall_do( int arg_count, int ret_value_count );
 void HandleMouseMovement( lua_State* L, float x, float y );
+void FlushScripts( lua_State* L );
 void ResetGameState();
 void UpdateMvp();
 void m4Mul( float* a, float* b, float* c );
 int FindRender( const char* name );
-void PushTransformedVert( Vertex v, DrawCall* call );
+void PushStagedVerts( int render, Vertex* verts, int count );
 int FindMesh(const char* name);
+void InitExpandInstance( );
+void ProfileDump( const char* path );
 
 void KeyCB( GLFWwindow* window, int key, int scancode, int action, int mods )
 {
 	if ( key == GLFW_KEY_ESCAPE && action == GLFW_PRESS )
 		glfwSetWindowShouldClose( window, GLFW_TRUE );
 
+	// hot-reload key, see src/util/fileloader.lua
+	if ( key == GLFW_KEY_R && action == GLFW_PRESS )
+		FlushScripts( L );
+
+#if POOK_PROFILE
+	if ( key == GLFW_KEY_F9 && action == GLFW_PRESS )
+		ProfileDump( PROFILE_PATH );
+#endif
+
 	pcall_setup( "SetKey" );
 	lua_pushnumber( L, (lua_Number)key );
 	lua_pushnumber( L, (lua_Number)action );
@@ -121,13 +265,22 @@ void MouseCB(GLFWwindow* window, double x, double y)
 	mouse_moved = 1;
 }
 
+// post processing target, the scene renders to it at render_scale times the window size
+tgFramebuffer fbo;
+float render_scale = 1.0f;
+
 void Reshape( GLFWwindow* window, int width, int height )
 {
 	// printf( "RESHAPE: %d %d\n", width, height );
-	GLfloat aspect = (GLfloat)height / (GLfloat)width;
+
+	// minimized
+	if ( !width || !height ) return;
+
+	GLfloat aspect = (GLfloat)width / (GLfloat)height;
 	float fov = 1.48353f;
-	tgPerspective( projection, fov, aspect, 0.1f, 10000.0f );
+	tgPerspective( projection, fov, aspect, NEAR_PLANE, FAR_PLANE );
 	glViewport( 0, 0, width, height );
+	if ( fbo.fb_id ) tgResizeFramebuffer( &fbo, width, height );
 }
 
 void PookSwapBuffers( )
@@ -346,22 +499,16 @@ int UpdateCam( lua_State *L )
 	v3 eye = V3(eyeX, eyeY, eyeZ);
 	v3 center = add( eye, V3( frontX, frontY, frontZ ) );
 	LookAt(cam, eye, center, V3(0, 1, 0));
-	v3 dir = norm( sub( center, eye ) );
-	tgSetActiveShader( &simple );
-	//tgSendF32( &simple, "u_eye", 1, (float*)&dir, 4 );
-	tgDeactivateShader( );
 	UpdateMvp();
 	return 0;
 }
 
 // make more generic. jk lol, this shit is gonna stay
-void UpdateTimeUniform(tgShader* shader)
+void UpdateTimeUniform()
 {
 	float tf = t / GAME_DURATION;
-	tgSetActiveShader(shader);
-	tgSendF32(shader, "u_time", 1, &t, 1);
-	tgSendF32(shader, "u_timeFraction", 1, &tf, 1);
-	tgDeactivateShader();
+	tgSetUniforms( &frame_block, TG_OFFSET_OF( FrameUniforms, time ), &t, sizeof( t ) );
+	tgSetUniforms( &frame_block, TG_OFFSET_OF( FrameUniforms, time_fraction ), &tf, sizeof( tf ) );
 }
 
 int ResetGameTime( lua_State *L )
@@ -370,12 +517,54 @@ int ResetGameTime( lua_State *L )
 	return 0;
 }
 
+typedef struct
+{
+	v3 n;
+	float d;
+} Plane;
+
+// left, right, bottom, top, near, far, in world space and facing inward
+Plane frustum[ 6 ];
+
+typedef struct
+{
+	int drawn;
+	int culled;
+} CullStats;
+
+// instances tested against the frustum this frame, and the totals of last frame
+CullStats cull_stats;
+CullStats last_cull_stats;
+
+// Gribb and Hartmann, the planes are sums and differences of the rows of the
+// column major clip matrix m.
+void UpdateFrustum( float* m )
+{
+	for ( int i = 0; i < 6; ++i )
+	{
+		int row = i / 2;
+		float sign = (i & 1) ? -1.0f : 1.0f;
+		v3 n = V3( m[ 3 ] + sign * m[ row ], m[ 7 ] + sign * m[ 4 + row ], m[ 11 ] + sign * m[ 8 + row ] );
+		float d = m[ 15 ] + sign * m[ 12 + row ];
+		float inv = 1.0f / len( n );
+		frustum[ i ].n = V3( n.x * inv, n.y * inv, n.z * inv );
+		frustum[ i ].d = d * inv;
+	}
+}
+
+int SphereInFrustum( v3 c, float r )
+{
+	for ( int i = 0; i < 6; ++i )
+		if ( dot( frustum[ i ].n, c ) + frustum[ i ].d < -r )
+			return 0;
+	return 1;
+}
+
 void UpdateMvp()
 {
 	m4Mul(projection, cam, mvp);
-	tgSetActiveShader( &simple );
-	tgSendMatrix( &simple, "u_mvp", mvp );
-	tgDeactivateShader( );
+	UpdateFrustum( mvp );
+	tgSetUniforms( &frame_block, TG_OFFSET_OF( FrameUniforms, mvp ), mvp, sizeof( mvp ) );
 }
 
 void m4Mul_internal( float a[ 4 ][ 4 ], float b[ 4 ][ 4 ], float* out )
@@ -454,7 +643,7 @@ void ErrorBox( const char *exp, const char *file, int line, const char *msg, ...
 #endif
 }
 
-#if defined(__APPLE__)
+#if defined(__APPLE__) || defined(__linux__)
 
 	#define MSG_BOX( msg, ... ) \
 		do \
@@ -545,6 +734,91 @@ void Dofile( lua_State* L, const char* name )
 		ErrorFunc( L );
 }
 
+// Scripts run every frame are compiled once and the resulting closure is kept
+// in the registry. They are only recompiled when the file on disk changes, or
+// when the hot-reload key flushes the cache.
+#define MAX_SCRIPTS 64
+typedef struct
+{
+	char* path;
+	time_t mtime;
+	int ref;
+} Script;
+
+int script_count;
+Script scripts[ MAX_SCRIPTS ];
+
+time_t ScriptModifiedTime( const char* path )
+{
+	struct stat st;
+	if ( stat( path, &st ) ) return 0;
+	return st.st_mtime;
+}
+
+Script* FindScript( const char* path )
+{
+	for ( int i = 0; i < script_count; ++i )
+	{
+		if ( !strcmp( scripts[ i ].path, path ) )
+			return scripts + i;
+	}
+
+	if ( script_count == MAX_SCRIPTS ) return 0;
+	Script* script = scripts + script_count++;
+	script->path = strdup( path );
+	script->mtime = 0;
+	script->ref = LUA_NOREF;
+	return script;
+}
+
+// Drops every cached closure so the next RunScript recompiles from disk.
+void FlushScripts( lua_State* L )
+{
+	for ( int i = 0; i < script_count; ++i )
+	{
+		luaL_unref( L, LUA_REGISTRYINDEX, scripts[ i ].ref );
+		scripts[ i ].ref = LUA_NOREF;
+	}
+}
+
+// The registry refs belong to a lua_State that is about to go away, so only
+// the C side bookkeeping is released here.
+void FreeScripts( )
+{
+	for ( int i = 0; i < script_count; ++i )
+		free( scripts[ i ].path );
+	script_count = 0;
+}
+
+int RunScript( lua_State* L )
+{
+	LUA_ERROR_IF( L, lua_gettop( L ) != 1, "RunScript expects 1 parameter, a string" );
+	const char* name = luaL_checkstring( L, -1 );
+	Script* script = FindScript( name );
+	if ( !script ) return luaL_error( L, "Hit MAX_SCRIPTS limit running %s", name );
+	lua_settop( L, 0 );
+
+	time_t mtime = ScriptModifiedTime( script->path );
+	if ( script->ref == LUA_NOREF || script->mtime != mtime )
+	{
+		int size;
+		char* source = (char*)ReadFileToMemory( script->path, &size );
+		if ( !source ) return luaL_error( L, "RunScript could not open %s", script->path );
+		const char* chunk_name = lua_pushfstring( L, "@%s", script->path );
+		int ret = luaL_loadbuffer( L, source, size, chunk_name );
+		free( source );
+		if ( ret ) return lua_error( L );
+		luaL_unref( L, LUA_REGISTRYINDEX, script->ref );
+		script->ref = luaL_ref( L, LUA_REGISTRYINDEX );
+		script->mtime = mtime;
+		lua_settop( L, 0 );
+	}
+
+	lua_rawgeti( L, LUA_REGISTRYINDEX, script->ref );
+	lua_call( L, 0, 0 );
+	return 0;
+}
+
 void pcall_setup( const char* func_name )
 {
 	lua_pushcfunction( L , ErrorFunc ); // 1
@@ -585,31 +859,106 @@ void HandleMouseMovement( lua_State* L, float x, float y )
 	pcall_do( 2, 0 );
 }
 
-#define MAX_MESHES 1024
-#define MAX_DRAW_CALLS 1024
+// Maps names to handles, open addressing with linear probing. Meshes and
+// renders are looked up by name once and referred to by handle after that.
+typedef struct
+{
+	int count;
+	int capacity;
+	uint32_t* hashes;
+	const char** keys;
+	int* values;
+} NameTable;
+
+void FreeNameTable( NameTable* table )
+{
+	free( table->hashes );
+	free( table->keys );
+	free( table->values );
+	memset( table, 0, sizeof( *table ) );
+}
+
+int NameTableFind( NameTable* table, const char* name )
+{
+	if ( !table->capacity ) return -1;
+	uint32_t hash = tg_djb2( (unsigned char*)name );
+	uint32_t mask = table->capacity - 1;
+
+	for ( uint32_t i = hash & mask; table->keys[ i ]; i = (i + 1) & mask )
+	{
+		if ( table->hashes[ i ] == hash && !strcmp( table->keys[ i ], name ) )
+			return table->values[ i ];
+	}
+
+	return -1;
+}
+
+// name must outlive the table, and must not already be in it
+void NameTableInsert( NameTable* table, const char* name, int value )
+{
+	// keep the load factor at or under one half
+	if ( (table->count + 1) * 2 > table->capacity )
+	{
+		NameTable old = *table;
+		table->count = 0;
+		table->capacity = old.capacity ? old.capacity * 2 : 64;
+		table->hashes = (uint32_t*)calloc( table->capacity, sizeof( uint32_t ) );
+		table->keys = (const char**)calloc( table->capacity, sizeof( const char* ) );
+		table->values = (int*)calloc( table->capacity, sizeof( int ) );
+
+		for ( int i = 0; i < old.capacity; ++i )
+			if ( old.keys[ i ] ) NameTableInsert( table, old.keys[ i ], old.values[ i ] );
+
+		FreeNameTable( &old );
+	}
+
+	uint32_t hash = tg_djb2( (unsigned char*)name );
+	uint32_t mask = table->capacity - 1;
+	uint32_t i = hash & mask;
+	while ( table->keys[ i ] ) i = (i + 1) & mask;
+	table->hashes[ i ] = hash;
+	table->keys[ i ] = name;
+	table->values[ i ] = value;
+	++table->count;
+}
+
+// handle indexed arrays, grown by doubling
 typedef struct
 {
 	int temp_count;
 	int temp_capacity;
 	Vertex* temp_verts;
 
-	int last_mesh;
 	int mesh_count;
-	const char* mesh_names[ MAX_MESHES ];
-	Mesh meshes[ MAX_MESHES ];
+	int mesh_capacity;
+	char** mesh_names;
+	Mesh* meshes;
+	NameTable mesh_table;
 
-	int last_render;
 	int render_count;
-	const char* render_names[ MAX_DRAW_CALLS ];
-	DrawCall calls[ MAX_DRAW_CALLS ];
+	int render_capacity;
+	char** render_names;
+	DrawCall* calls;
+	NameTable render_table;
 } Meshes;
 
 Meshes meshes;
 
+// draw calls pushed to tinygl per frame: one per render, plus one per instanced
+// mesh. Only the starting size, the context grows past it as handles are added.
+#define INITIAL_FRAME_DRAW_CALLS 2048
+
 void InitMeshes( )
 {
+	InitExpandInstance( );
 	meshes.temp_verts = (Vertex*)malloc( sizeof( Vertex ) * 1024 );
 	meshes.temp_capacity = 1024;
+	meshes.mesh_capacity = 64;
+	meshes.mesh_names = (char**)malloc( sizeof( char* ) * meshes.mesh_capacity );
+	meshes.meshes = (Mesh*)malloc( sizeof( Mesh ) * meshes.mesh_capacity );
+	meshes.render_capacity = 16;
+	meshes.render_names = (char**)malloc( sizeof( char* ) * meshes.render_capacity );
+	meshes.calls = (DrawCall*)malloc( sizeof( DrawCall ) * meshes.render_capacity );
 }
 
 void FreeMeshes( )
@@ -617,242 +966,2179 @@ void FreeMeshes( )
 	free( meshes.temp_verts );
 	for ( int i = 0; i < meshes.mesh_count; ++i )
 	{
-		free( (char*)meshes.mesh_names[ i ] );
+		free( meshes.mesh_names[ i ] );
 		free( meshes.meshes[ i ].verts );
+		free( meshes.meshes[ i ].px );
+		free( meshes.meshes[ i ].instances );
+		tgFreeRenderable( &meshes.meshes[ i ].r );
+	}
+	for ( int i = 0; i < meshes.render_count; ++i )
+	{
+		free( meshes.render_names[ i ] );
+		free( meshes.calls[ i ].verts );
 	}
+	free( meshes.mesh_names );
+	free( meshes.meshes );
+	free( meshes.render_names );
+	free( meshes.calls );
+	FreeNameTable( &meshes.mesh_table );
+	FreeNameTable( &meshes.render_table );
 	memset( &meshes, 0, sizeof( meshes ) );
 }
 
-int PushMesh( lua_State *L )
+#define INSTANCE_STREAM_SIZE (1024 * 16)
+
+void MakeInstanceVertexData( tgVertexData* vd, int instance_count )
 {
-	LUA_ERROR_IF( L, lua_gettop( L ) != 1, "PushMesh expects 1 parameters, a string" );
-	ERROR_IF( meshes.mesh_count >= MAX_MESHES, "Hit MAX_MESHES limit" );
-	const char* name = luaL_checkstring( L, -1 );
-	lua_settop( L, 0 );
-	int i = FindMesh(name);
-	i = i != -1 ? i : meshes.mesh_count++;
-	Mesh* mesh = meshes.meshes + i;
-	mesh->vert_count = meshes.temp_count;
-	int size = sizeof( Vertex ) * mesh->vert_count;
-	mesh->verts = (Vertex*)malloc( size );
-	memcpy( mesh->verts, meshes.temp_verts, size );
-	meshes.mesh_names[ i ] = strdup( name );
-	meshes.temp_count = 0;
-	return 0;
+	tgMakeVertexData( vd, instance_count, GL_TRIANGLES, sizeof( InstanceData ), GL_DYNAMIC_DRAW );
+	tgAddAttribute( vd, "a_offset", 3, TG_FLOAT, TG_OFFSET_OF( InstanceData, offset ) );
+	tgAddAttribute( vd, "a_scale", 3, TG_FLOAT, TG_OFFSET_OF( InstanceData, scale ) );
+	tgAddAttribute( vd, "a_rotation", 4, TG_FLOAT, TG_OFFSET_OF( InstanceData, rotation ) );
 }
 
-int FlushVerts( lua_State *L )
+// m3Rotation rotates by -angle, so the quaternion does too to keep both paths in agreement.
+InstanceData MakeInstanceData( v3 p, v3 s, v3 axis, float angle )
 {
-	LUA_ERROR_IF( L, lua_gettop( L ) != 1, "PushMesh expects 1 parameters, a string" );
-	const char* name = luaL_checkstring( L, -1 );
-	lua_settop( L, 0 );
-	int index = FindRender( name );
-	DrawCall* dc = meshes.calls + index;
+	InstanceData data;
+	float half_sin = sinf( -angle * 0.5f );
+	data.offset = p;
+	data.scale = s;
+	data.rotation[ 0 ] = axis.x * half_sin;
+	data.rotation[ 1 ] = axis.y * half_sin;
+	data.rotation[ 2 ] = axis.z * half_sin;
+	data.rotation[ 3 ] = cosf( -angle * 0.5f );
+	return data;
+}
 
-	for ( int i = 0; i < meshes.temp_count; ++i )
-	{
-		Vertex v = meshes.temp_verts[ i ];
-		PushTransformedVert( v, dc );
-	}
+void MakeMeshRenderable( Mesh* mesh )
+{
+	tgVertexData vd;
+	tgMakeVertexData( &vd, mesh->vert_count, GL_TRIANGLES, sizeof( MeshVertex ), GL_STATIC_DRAW );
+	tgAddAttribute( &vd, "a_pos", 4, TG_HALF, TG_OFFSET_OF( MeshVertex, position ) );
+	tgAddAttribute( &vd, "a_col", 4, TG_UNORM8, TG_OFFSET_OF( MeshVertex, color ) );
+	tgAddAttribute( &vd, "a_normal", 4, TG_SNORM10, TG_OFFSET_OF( MeshVertex, normal ) );
 
-	meshes.temp_count = 0;
-	return 0;
+	tgVertexData instance_vd;
+	MakeInstanceVertexData( &instance_vd, INSTANCE_STREAM_SIZE );
+
+	tgMakeInstancedRenderable( &mesh->r, &vd, &instance_vd );
+	tgSetShader( &mesh->r, &simple );
 }
 
-void PushVert( Vertex v )
+#define EXPAND_BLOCK 8
+
+int PadToBlock( int count )
 {
-	if ( meshes.temp_count == meshes.temp_capacity )
-	{
-		int new_cap = meshes.temp_capacity * 2;
-		Vertex* new_verts = (Vertex*)malloc( sizeof( Vertex ) * new_cap );
-		memcpy( new_verts, meshes.temp_verts, sizeof( Vertex ) * meshes.temp_count );
-		free( meshes.temp_verts );
-		meshes.temp_capacity = new_cap;
-		meshes.temp_verts = new_verts;
-	}
-	meshes.temp_verts[ meshes.temp_count++ ] = v;
+	return (count + EXPAND_BLOCK - 1) & ~(EXPAND_BLOCK - 1);
 }
 
-int PushVert_internal( lua_State *L )
+uint32_t PackColor( v3 c )
 {
-	LUA_ERROR_IF( L, lua_gettop( L ) != 9, "PushVert_internal expects 9 parameters, all floats" );
-	float x = (float)luaL_checknumber( L, -9 );
-	float y = (float)luaL_checknumber( L, -8 );
-	float z = (float)luaL_checknumber( L, -7 );
-	float cx = (float)luaL_checknumber( L, -6 );
-	float cy = (float)luaL_checknumber( L, -5 );
-	float cz = (float)luaL_checknumber( L, -4 );
-	float nx = (float)luaL_checknumber( L, -3 );
-	float ny = (float)luaL_checknumber( L, -2 );
-	float nz = (float)luaL_checknumber( L, -1 );
-	lua_settop( L, 0 );
-	Vertex v;
-	v.position = V3( x, y, z );
-	v.color = V3( cx, cy, cz );
-	v.normal = V3( nx, ny, nz );
-	PushVert( v );
-	return 0;
+	return tgPackUnorm8( c.x, c.y, c.z, 1.0f );
 }
 
-#define Register( L, func ) Register_internal( L, func, #func )
-void Register_internal( lua_State *L, lua_CFunction func, const char* name )
+uint32_t PackNormal( v3 n )
 {
-	lua_pushcfunction( L, func );
-	lua_setglobal( L, name );
+	return tgPackSnorm10( n.x, n.y, n.z );
 }
 
-void PushTransformedVert( Vertex v, DrawCall* call )
+StreamVertex PackStreamVertex( Vertex* v )
 {
-	if ( call->count == call->capacity )
-	{
-		int new_cap = call->capacity * 2;
-		Vertex* new_verts = (Vertex*)malloc( sizeof( Vertex ) * new_cap );
-		memcpy( new_verts, call->verts, sizeof( Vertex ) * call->count );
-		free( call->verts );
-		call->capacity = new_cap;
-		call->verts = new_verts;
-	}
-	call->verts[ call->count++ ] = v;
+	StreamVertex out;
+	out.position = v->position;
+	out.color = PackColor( v->color );
+	out.normal = PackNormal( v->normal );
+	return out;
 }
 
-int FindRender( const char* name )
+MeshVertex PackMeshVertex( Vertex* v )
 {
-	int index = meshes.last_render;
-	int found = 0;
+	MeshVertex out;
+	out.position[ 0 ] = tgHalf( v->position.x );
+	out.position[ 1 ] = tgHalf( v->position.y );
+	out.position[ 2 ] = tgHalf( v->position.z );
+	out.position[ 3 ] = tgHalf( 1.0f );
+	out.color = PackColor( v->color );
+	out.normal = PackNormal( v->normal );
+	return out;
+}
 
-	if ( !strcmp( meshes.render_names[ index ], name ) ) found = 1;
-	else
+// Expects the face normals to already be stored in mesh->verts.
+void MakeMeshSoA( Mesh* mesh )
+{
+	int vert_count = PadToBlock( mesh->vert_count );
+	mesh->face_count = mesh->vert_count / 3;
+	int face_count = PadToBlock( mesh->face_count );
+	float* soa = (float*)calloc( 4 * vert_count + 3 * face_count, sizeof( float ) );
+	mesh->px = soa;
+	mesh->py = mesh->px + vert_count;
+	mesh->pz = mesh->py + vert_count;
+	mesh->nx = mesh->pz + vert_count;
+	mesh->ny = mesh->nx + face_count;
+	mesh->nz = mesh->ny + face_count;
+	mesh->colors = (uint32_t*)(mesh->nz + face_count);
+
+	for ( int i = 0; i < mesh->vert_count; ++i )
 	{
-		for ( int i = 0; i < meshes.render_count; ++i )
-		{
-			if ( !strcmp( meshes.render_names[ i ], name ) )
-			{
-				index = i;
-				found = 1;
-				break;
-			}
-		}
+		Vertex* v = mesh->verts + i;
+		mesh->px[ i ] = v->position.x;
+		mesh->py[ i ] = v->position.y;
+		mesh->pz[ i ] = v->position.z;
+		mesh->colors[ i ] = PackColor( v->color );
 	}
 
-	if ( !found ) ERROR_IF( 0, "SetRender could not find %s", name );
-	meshes.last_render = index;
-	return index;
+	for ( int i = 0; i < mesh->face_count; ++i )
+	{
+		v3 n = mesh->verts[ i * 3 ].normal;
+		mesh->nx[ i ] = n.x;
+		mesh->ny[ i ] = n.y;
+		mesh->nz[ i ] = n.z;
+	}
 }
 
-int FindMesh(const char* name)
+// Sphere around the center of the mesh's AABB, looser than a minimal sphere but
+// never missing a vert.
+void MakeMeshBounds( Mesh* mesh )
 {
-	if (meshes.last_mesh && !strcmp(meshes.mesh_names[meshes.last_mesh], name))
+	v3 lo = V3( FLT_MAX, FLT_MAX, FLT_MAX );
+	v3 hi = V3( -FLT_MAX, -FLT_MAX, -FLT_MAX );
+
+	for ( int i = 0; i < mesh->vert_count; ++i )
 	{
-		return meshes.last_mesh;
+		v3 p = mesh->verts[ i ].position;
+		lo = V3( p.x < lo.x ? p.x : lo.x, p.y < lo.y ? p.y : lo.y, p.z < lo.z ? p.z : lo.z );
+		hi = V3( p.x > hi.x ? p.x : hi.x, p.y > hi.y ? p.y : hi.y, p.z > hi.z ? p.z : hi.z );
 	}
 
-	for (int i = 0; i < meshes.mesh_count; i++)
+	v3 c = mesh->vert_count ? V3( (lo.x + hi.x) * 0.5f, (lo.y + hi.y) * 0.5f, (lo.z + hi.z) * 0.5f ) : V3( 0, 0, 0 );
+	float r2 = 0;
+
+	for ( int i = 0; i < mesh->vert_count; ++i )
 	{
-		if (!strcmp(meshes.mesh_names[i], name))
-		{
-			return i;
-		}
+		v3 d = sub( mesh->verts[ i ].position, c );
+		float d2 = dot( d, d );
+		if ( d2 > r2 ) r2 = d2;
 	}
 
-	return -1;
+	mesh->bound_center = c;
+	mesh->bound_radius = sqrtf( r2 );
 }
 
-int PushInstance_internal( lua_State *L )
+// Tom Forsyth's linear speed vertex cache optimisation: greedily emits the
+// triangle whose verts score best, favouring verts that are already in a
+// simulated LRU cache and verts with few triangles left to draw.
+// see: https://tomforsyth1000.github.io/papers/fast_vert_cache_opt.html
+#define VCACHE_SIZE 32
+
+float VcacheScore( int cache_pos, int live_tris )
 {
-	LUA_ERROR_IF( L, lua_gettop( L ) != 12, "PushInstance expects 12 parameters, two strings and 10 floats" );
-	const char* render_name = luaL_checkstring( L, -12 );
-	const char* mesh_name = luaL_checkstring( L, -11 );
-	float x = (float)luaL_checknumber( L, -10 );
-	float y = (float)luaL_checknumber( L, -9 );
-	float z = (float)luaL_checknumber( L, -8 );
-	float sx = (float)luaL_checknumber( L, -7 );
-	float sy = (float)luaL_checknumber( L, -6 );
-	float sz = (float)luaL_checknumber( L, -5 );
-	float rx = (float)luaL_checknumber( L, -4 );
-	float ry = (float)luaL_checknumber( L, -3 );
-	float rz = (float)luaL_checknumber( L, -2 );
-	float ra = (float)luaL_checknumber( L, -1 );
-	lua_settop( L, 0 );
-	v3 p = V3( x, y, z );
+	if ( !live_tris ) return -1.0f;
 
-	int index = FindMesh(mesh_name);
+	float score = 0;
+	if ( cache_pos < 0 ) score = 0;
+	else if ( cache_pos < 3 ) score = 0.75f;
+	else score = powf( 1.0f - (float)(cache_pos - 3) / (VCACHE_SIZE - 3), 1.5f );
 
-	if ( index == -1 )
+	return score + 2.0f / sqrtf( (float)live_tris );
+}
+
+// Reorders the triangles of indices in place, keeping the corner order of each.
+void OptimizeVertexCache( uint32_t* indices, int index_count, int vert_count )
+{
+	int tri_count = index_count / 3;
+	int* start = (int*)malloc( sizeof( int ) * (vert_count + 1) );
+	int* cache_pos = (int*)malloc( sizeof( int ) * vert_count );
+	float* vert_score = (float*)malloc( sizeof( float ) * vert_count );
+	int* adjacency = (int*)malloc( sizeof( int ) * index_count );
+	float* tri_score = (float*)malloc( sizeof( float ) * tri_count );
+	char* emitted = (char*)calloc( tri_count, 1 );
+	uint32_t* out = (uint32_t*)malloc( sizeof( uint32_t ) * index_count );
+
+	// per vert triangle lists, start[ v ] is the offset of v's list in adjacency
+	int* counts = (int*)calloc( vert_count, sizeof( int ) );
+	for ( int i = 0; i < index_count; ++i ) counts[ indices[ i ] ]++;
+	int offset = 0;
+	for ( int v = 0; v < vert_count; ++v )
 	{
-		ERROR_IF( 0, "SetRender could not find %s", mesh_name );
-		return 0;
+		start[ v ] = offset;
+		offset += counts[ v ];
+		counts[ v ] = 0;
+	}
+	for ( int i = 0; i < index_count; ++i )
+	{
+		int v = indices[ i ];
+		adjacency[ start[ v ] + counts[ v ]++ ] = i / 3;
 	}
+	int* live_tris = counts;
 
-	meshes.last_mesh = index;
-	Mesh* mesh = meshes.meshes + index;
-	DrawCall* call = meshes.calls + FindRender( render_name );
+	for ( int v = 0; v < vert_count; ++v )
+	{
+		cache_pos[ v ] = -1;
+		vert_score[ v ] = VcacheScore( -1, live_tris[ v ] );
+	}
+	for ( int t = 0; t < tri_count; ++t )
+		tri_score[ t ] = vert_score[ indices[ t * 3 ] ] + vert_score[ indices[ t * 3 + 1 ] ] + vert_score[ indices[ t * 3 + 2 ] ];
 
-	v3 axis = V3( rx, ry, rz );
-	float angle = ra;
-	m3 r = m3Rotation( axis, angle );
+	int cache[ VCACHE_SIZE + 3 ];
+	int cache_count = 0;
+	int best = -1;
+	int cursor = 0;
 
-	for ( int i = 0; i < mesh->vert_count; i += 3 )
+	for ( int emit = 0; emit < tri_count; ++emit )
 	{
-		Vertex a = mesh->verts[ i ];
-		Vertex b = mesh->verts[ i + 1 ];
-		Vertex c = mesh->verts[ i + 2 ];
+		// nothing left next to the cache, carry on with the next unemitted triangle
+		if ( best == -1 )
+		{
+			while ( emitted[ cursor ] ) ++cursor;
+			best = cursor;
+		}
 
-		a.position = v3Mul( r, a.position );
-		b.position = v3Mul( r, b.position );
-		c.position = v3Mul( r, c.position );
+		emitted[ best ] = 1;
+		uint32_t* tri = indices + best * 3;
+		memcpy( out + emit * 3, tri, sizeof( uint32_t ) * 3 );
+
+		// drop best from the triangle lists of its verts
+		for ( int j = 0; j < 3; ++j )
+		{
+			int v = tri[ j ];
+			int* list = adjacency + start[ v ];
+			for ( int k = 0; k < live_tris[ v ]; ++k )
+			{
+				if ( list[ k ] == best )
+				{
+					list[ k ] = list[ --live_tris[ v ] ];
+					break;
+				}
+			}
+		}
 
-		a.position.x *= sx;
-		a.position.y *= sy;
-		a.position.z *= sz;
-		b.position.x *= sx;
-		b.position.y *= sy;
-		b.position.z *= sz;
-		c.position.x *= sx;
-		c.position.y *= sy;
-		c.position.z *= sz;
+		// most recently used first, the three verts of best then the old cache minus them
+		int new_cache[ VCACHE_SIZE + 3 ];
+		int new_count = 0;
+		for ( int j = 0; j < 3; ++j ) new_cache[ new_count++ ] = tri[ j ];
+		for ( int j = 0; j < cache_count; ++j )
+		{
+			int v = cache[ j ];
+			if ( v != (int)tri[ 0 ] && v != (int)tri[ 1 ] && v != (int)tri[ 2 ] ) new_cache[ new_count++ ] = v;
+		}
 
-		a.position = add( a.position, p );
-		b.position = add( b.position, p );
-		c.position = add( c.position, p );
+		for ( int j = 0; j < new_count; ++j )
+		{
+			int v = new_cache[ j ];
+			cache_pos[ v ] = j < VCACHE_SIZE ? j : -1;
+			vert_score[ v ] = VcacheScore( cache_pos[ v ], live_tris[ v ] );
+		}
 
-		v3 n = norm( cross( sub( b.position, a.position ), sub( b.position, c.position ) ) );
-		a.normal = n;
-		b.normal = n;
-		c.normal = n;
+		// rescore the triangles touching the cache, the best of them goes next
+		best = -1;
+		float best_score = -1.0f;
+		for ( int j = 0; j < new_count; ++j )
+		{
+			int v = new_cache[ j ];
+			int* list = adjacency + start[ v ];
+			for ( int k = 0; k < live_tris[ v ]; ++k )
+			{
+				int t = list[ k ];
+				uint32_t* other = indices + t * 3;
+				tri_score[ t ] = vert_score[ other[ 0 ] ] + vert_score[ other[ 1 ] ] + vert_score[ other[ 2 ] ];
+				if ( tri_score[ t ] > best_score )
+				{
+					best_score = tri_score[ t ];
+					best = t;
+				}
+			}
+		}
 
-		PushTransformedVert( a, call );
-		PushTransformedVert( b, call );
-		PushTransformedVert( c, call );
+		cache_count = new_count < VCACHE_SIZE ? new_count : VCACHE_SIZE;
+		memcpy( cache, new_cache, sizeof( int ) * cache_count );
 	}
 
-	return 0;
+	memcpy( indices, out, sizeof( uint32_t ) * index_count );
+	free( start );
+	free( cache_pos );
+	free( vert_score );
+	free( adjacency );
+	free( tri_score );
+	free( emitted );
+	free( out );
+	free( counts );
 }
 
-int Flush( lua_State *L )
+// Uploads the flat shaded triangle soup of mesh as indexed geometry. Corners are
+// welded by position and color. simple.vs passes the normal through flat, so GL
+// takes it from the last vert of each triangle: every triangle is rotated to end
+// on a vert that is free to carry its face normal, and only gets a copy of a vert
+// when none of its three are. Closed meshes end up with about one vert per face
+// instead of three.
+void UploadMesh( Mesh* mesh )
 {
-	LUA_ERROR_IF( L, lua_gettop( L ) != 1, "SetRender expects 1 parameter, a string" );
-	const char* name = luaL_checkstring( L, -1 );
-	lua_settop( L, 0 );
-	int call_index = FindRender( name );
-	DrawCall* dc = meshes.calls + call_index;
-	tgDrawCall call;
-	call.texture_count = 0;
-	call.r = &dc->r;
-	call.verts = dc->verts;
-	call.vert_count = dc->count;
-	return 0;
-}
+	int count = mesh->vert_count / 3 * 3;
+	// room for every corner plus one copy per triangle
+	Vertex* verts = (Vertex*)malloc( sizeof( Vertex ) * (count + count / 3 + 1) );
+	uint32_t* indices = (uint32_t*)malloc( sizeof( uint32_t ) * (count + 1) );
+	char* has_normal = (char*)calloc( count + count / 3 + 1, 1 );
+	int table_size = 1;
+	while ( table_size < count * 2 ) table_size *= 2;
+	int* table = (int*)malloc( sizeof( int ) * table_size );
+	for ( int i = 0; i < table_size; ++i ) table[ i ] = -1;
+	int unique = 0;
+
+	for ( int i = 0; i < count; ++i )
+	{
+		Vertex* v = mesh->verts + i;
+		uint32_t bits[ 6 ];
+		memcpy( bits, &v->position, sizeof( v3 ) );
+		memcpy( bits + 3, &v->color, sizeof( v3 ) );
+		uint32_t h = 2166136261u;
+		for ( int j = 0; j < 6; ++j ) h = (h ^ bits[ j ]) * 16777619u;
+		uint32_t slot = h & (table_size - 1);
+
+		while ( table[ slot ] != -1 )
+		{
+			Vertex* u = verts + table[ slot ];
+			if ( !memcmp( &u->position, &v->position, sizeof( v3 ) ) && !memcmp( &u->color, &v->color, sizeof( v3 ) ) ) break;
+			slot = (slot + 1) & (table_size - 1);
+		}
 
-void AddRender( tgRenderable* render, const char* name )
-{
-	ERROR_IF( meshes.render_count == MAX_DRAW_CALLS, "Hit MAX_RENDERS" );
-	meshes.render_names[ meshes.render_count ] = name;
-	DrawCall call;
-	memset( &call, 0, sizeof( call ) );
-	call.r = *render;
+		if ( table[ slot ] == -1 )
+		{
+			table[ slot ] = unique;
+			verts[ unique ] = *v;
+			verts[ unique++ ].normal = V3( 0, 0, 0 );
+		}
+
+		indices[ i ] = table[ slot ];
+	}
+	free( table );
+
+	// pick the provoking vert of each triangle, the face normal is on all three corners
+	int extra = 0;
+	for ( int t = 0; t < count; t += 3 )
+	{
+		uint32_t* tri = indices + t;
+		v3 n = mesh->verts[ t ].normal;
+		int last = -1;
+
+		for ( int j = 2; j >= 0 && last == -1; --j )
+		{
+			Vertex* v = verts + tri[ j ];
+			if ( !has_normal[ tri[ j ] ] || !memcmp( &v->normal, &n, sizeof( v3 ) ) ) last = j;
+		}
+
+		if ( last == -1 )
+		{
+			// copies go after the welded verts
+			verts[ unique + extra ] = verts[ tri[ 2 ] ];
+			tri[ 2 ] = unique + extra++;
+			last = 2;
+		}
+
+		verts[ tri[ last ] ].normal = n;
+		has_normal[ tri[ last ] ] = 1;
+
+		// rotating keeps the winding
+		uint32_t a = tri[ 0 ], b = tri[ 1 ], c = tri[ 2 ];
+		if ( last == 0 ) { tri[ 0 ] = b; tri[ 1 ] = c; tri[ 2 ] = a; }
+		else if ( last == 1 ) { tri[ 0 ] = c; tri[ 1 ] = a; tri[ 2 ] = b; }
+	}
+	free( has_normal );
+	int vert_count = unique + extra;
+
+	OptimizeVertexCache( indices, count, vert_count );
+
+	// renumber verts in the order the indices first use them, for fetch locality
+	uint32_t* remap = (uint32_t*)malloc( sizeof( uint32_t ) * (vert_count + 1) );
+	MeshVertex* ordered = (MeshVertex*)malloc( sizeof( MeshVertex ) * (vert_count + 1) );
+	memset( remap, 0xFF, sizeof( uint32_t ) * (vert_count + 1) );
+	int next = 0;
+	for ( int i = 0; i < count; ++i )
+	{
+		if ( remap[ indices[ i ] ] == 0xFFFFFFFF )
+		{
+			ordered[ next ] = PackMeshVertex( verts + indices[ i ] );
+			remap[ indices[ i ] ] = next++;
+		}
+		indices[ i ] = remap[ indices[ i ] ];
+	}
+
+	tgUpload( &mesh->r, ordered, next );
+	tgUploadIndices( &mesh->r, indices, count );
+	free( remap );
+	free( ordered );
+	free( verts );
+	free( indices );
+}
+
+// Registers verts as a mesh called name, or replaces the verts of the mesh
+// already called name. Returns the handle, the same one as before when replacing.
+int AddMesh( const char* name, Vertex* verts, int vert_count )
+{
+	int i = FindMesh(name);
+	int replacing = i != -1;
+
+	if ( !replacing && meshes.mesh_count == meshes.mesh_capacity )
+	{
+		meshes.mesh_capacity *= 2;
+		meshes.mesh_names = (char**)realloc( meshes.mesh_names, sizeof( char* ) * meshes.mesh_capacity );
+		meshes.meshes = (Mesh*)realloc( meshes.meshes, sizeof( Mesh ) * meshes.mesh_capacity );
+	}
+
+	i = replacing ? i : meshes.mesh_count++;
+	Mesh* mesh = meshes.meshes + i;
+	if ( replacing )
+	{
+		free( mesh->verts );
+		free( mesh->px );
+	}
+	mesh->vert_count = vert_count;
+	int size = sizeof( Vertex ) * mesh->vert_count;
+	mesh->verts = (Vertex*)malloc( size );
+	memcpy( mesh->verts, verts, size );
+
+	// object space face normals, the vertex shader rotates and scales them per instance
+	for ( int j = 0; j + 2 < mesh->vert_count; j += 3 )
+	{
+		Vertex* a = mesh->verts + j;
+		Vertex* b = a + 1;
+		Vertex* c = a + 2;
+		v3 n = norm( cross( sub( b->position, a->position ), sub( b->position, c->position ) ) );
+		a->normal = n;
+		b->normal = n;
+		c->normal = n;
+	}
+	MakeMeshSoA( mesh );
+	MakeMeshBounds( mesh );
+	mesh->lod_count = 1;
+	mesh->lods[ 0 ] = i;
+
+	// the CPU copy stays around for PushInstance_internal, draws only use the
+	// indexed static VBO made by UploadMesh
+	if ( !replacing )
+	{
+		meshes.mesh_names[ i ] = strdup( name );
+		NameTableInsert( &meshes.mesh_table, meshes.mesh_names[ i ], i );
+		mesh->instance_count = 0;
+		mesh->instance_capacity = 64;
+		mesh->instances = (InstanceData*)malloc( sizeof( InstanceData ) * mesh->instance_capacity );
+		MakeMeshRenderable( mesh );
+	}
+	UploadMesh( mesh );
+	return i;
+}
+
+// Quadric error metric edge collapse (Garland and Heckbert) in the iterative
+// form from Sven Forstmann's Fast Quadric Mesh Simplification. Instead of
+// keeping a priority queue, each pass collapses every edge whose error is under
+// a threshold that grows from pass to pass. Works on welded positions, so the
+// flat shaded triangle soups PushMesh gets are welded first.
+
+typedef struct
+{
+	double m[ 10 ];
+} Quadric;
+
+typedef struct
+{
+	v3 p;
+	v3 color;
+	Quadric q;
+	int tstart;
+	int tcount;
+	int border;
+} SimplifyVert;
+
+typedef struct
+{
+	int v[ 3 ];
+	double err[ 4 ];
+	int deleted;
+	int dirty;
+	v3 n;
+} SimplifyTri;
+
+typedef struct
+{
+	int tri;
+	int corner;
+} SimplifyRef;
+
+typedef struct
+{
+	int vert_count;
+	SimplifyVert* verts;
+	int tri_count;
+	int live_tri_count;
+	SimplifyTri* tris;
+	int ref_count;
+	int ref_capacity;
+	SimplifyRef* refs;
+	int scratch_capacity;
+	char* deleted0;
+	char* deleted1;
+} Simplifier;
+
+Quadric QuadricFromPlane( double a, double b, double c, double d )
+{
+	Quadric q = { { a * a, a * b, a * c, a * d, b * b, b * c, b * d, c * c, c * d, d * d } };
+	return q;
+}
+
+double QuadricDet( Quadric* q, int a11, int a12, int a13, int a21, int a22, int a23, int a31, int a32, int a33 )
+{
+	double* m = q->m;
+	return m[ a11 ] * m[ a22 ] * m[ a33 ] + m[ a13 ] * m[ a21 ] * m[ a32 ] + m[ a12 ] * m[ a23 ] * m[ a31 ]
+		- m[ a13 ] * m[ a22 ] * m[ a31 ] - m[ a11 ] * m[ a23 ] * m[ a32 ] - m[ a12 ] * m[ a21 ] * m[ a33 ];
+}
+
+double QuadricError( Quadric* q, double x, double y, double z )
+{
+	double* m = q->m;
+	return m[ 0 ] * x * x + 2 * m[ 1 ] * x * y + 2 * m[ 2 ] * x * z + 2 * m[ 3 ] * x + m[ 4 ] * y * y
+		+ 2 * m[ 5 ] * y * z + 2 * m[ 6 ] * y + m[ 7 ] * z * z + 2 * m[ 8 ] * z + m[ 9 ];
+}
+
+v3 SafeNorm( v3 a )
+{
+	float l = len( a );
+	return l > 0 ? sMul( a, 1.0f / l ) : a;
+}
+
+// Error of collapsing the edge i0 i1, and the position the merged vert goes to.
+double EdgeError( Simplifier* s, int i0, int i1, v3* result )
+{
+	SimplifyVert* v0 = s->verts + i0;
+	SimplifyVert* v1 = s->verts + i1;
+	Quadric q;
+	for ( int i = 0; i < 10; ++i ) q.m[ i ] = v0->q.m[ i ] + v1->q.m[ i ];
+
+	double det = QuadricDet( &q, 0, 1, 2, 1, 4, 5, 2, 5, 7 );
+	if ( det != 0 && !(v0->border && v1->border) )
+	{
+		double x = -1.0 / det * QuadricDet( &q, 1, 2, 3, 4, 5, 6, 5, 7, 8 );
+		double y = 1.0 / det * QuadricDet( &q, 0, 2, 3, 1, 5, 6, 2, 7, 8 );
+		double z = -1.0 / det * QuadricDet( &q, 0, 1, 3, 1, 4, 6, 2, 5, 8 );
+		*result = V3( (float)x, (float)y, (float)z );
+		return QuadricError( &q, x, y, z );
+	}
+
+	v3 mid = lerp( v0->p, v1->p, 0.5f );
+	double e0 = QuadricError( &q, v0->p.x, v0->p.y, v0->p.z );
+	double e1 = QuadricError( &q, v1->p.x, v1->p.y, v1->p.z );
+	double em = QuadricError( &q, mid.x, mid.y, mid.z );
+	double e = e0 < e1 ? (e0 < em ? e0 : em) : (e1 < em ? e1 : em);
+	*result = e == e0 ? v0->p : e == e1 ? v1->p : mid;
+	return e;
+}
+
+void TriangleErrors( Simplifier* s, SimplifyTri* t )
+{
+	v3 p;
+	t->err[ 0 ] = EdgeError( s, t->v[ 0 ], t->v[ 1 ], &p );
+	t->err[ 1 ] = EdgeError( s, t->v[ 1 ], t->v[ 2 ], &p );
+	t->err[ 2 ] = EdgeError( s, t->v[ 2 ], t->v[ 0 ], &p );
+	double e = t->err[ 0 ] < t->err[ 1 ] ? t->err[ 0 ] : t->err[ 1 ];
+	t->err[ 3 ] = e < t->err[ 2 ] ? e : t->err[ 2 ];
+}
+
+void PushSimplifyRef( Simplifier* s, SimplifyRef ref )
+{
+	if ( s->ref_count == s->ref_capacity )
+	{
+		s->ref_capacity *= 2;
+		s->refs = (SimplifyRef*)realloc( s->refs, sizeof( SimplifyRef ) * s->ref_capacity );
+	}
+	s->refs[ s->ref_count++ ] = ref;
+}
+
+// Drops deleted triangles and rebuilds the vert to triangle refs. The first
+// call also finds border verts and sets up the quadrics and edge errors.
+void SimplifyUpdate( Simplifier* s, int init )
+{
+	int live = 0;
+	for ( int i = 0; i < s->tri_count; ++i )
+		if ( !s->tris[ i ].deleted )
+			s->tris[ live++ ] = s->tris[ i ];
+	s->tri_count = live;
+
+	for ( int i = 0; i < s->vert_count; ++i )
+	{
+		s->verts[ i ].tstart = 0;
+		s->verts[ i ].tcount = 0;
+	}
+
+	for ( int i = 0; i < s->tri_count; ++i )
+		for ( int j = 0; j < 3; ++j )
+			s->verts[ s->tris[ i ].v[ j ] ].tcount++;
+
+	int tstart = 0;
+	for ( int i = 0; i < s->vert_count; ++i )
+	{
+		s->verts[ i ].tstart = tstart;
+		tstart += s->verts[ i ].tcount;
+		s->verts[ i ].tcount = 0;
+	}
+
+	s->ref_count = s->tri_count * 3;
+	if ( s->ref_count > s->ref_capacity )
+	{
+		s->ref_capacity = s->ref_count * 2;
+		s->refs = (SimplifyRef*)realloc( s->refs, sizeof( SimplifyRef ) * s->ref_capacity );
+	}
+	for ( int i = 0; i < s->tri_count; ++i )
+	{
+		for ( int j = 0; j < 3; ++j )
+		{
+			SimplifyVert* v = s->verts + s->tris[ i ].v[ j ];
+			SimplifyRef ref = { i, j };
+			s->refs[ v->tstart + v->tcount++ ] = ref;
+		}
+	}
+
+	if ( !init ) return;
+
+	// an edge used by only one triangle is on the border, its verts stay put
+	int* ids = 0;
+	int* counts = 0;
+	int capacity = 0;
+	for ( int i = 0; i < s->vert_count; ++i )
+	{
+		SimplifyVert* v = s->verts + i;
+		if ( v->tcount * 2 > capacity )
+		{
+			capacity = v->tcount * 2;
+			ids = (int*)realloc( ids, sizeof( int ) * capacity );
+			counts = (int*)realloc( counts, sizeof( int ) * capacity );
+		}
+
+		int id_count = 0;
+		for ( int j = 0; j < v->tcount; ++j )
+		{
+			SimplifyTri* t = s->tris + s->refs[ v->tstart + j ].tri;
+			for ( int k = 0; k < 3; ++k )
+			{
+				int id = t->v[ k ];
+				int found = 0;
+				while ( found < id_count && ids[ found ] != id ) ++found;
+				if ( found == id_count )
+				{
+					ids[ id_count ] = id;
+					counts[ id_count++ ] = 1;
+				}
+				else counts[ found ]++;
+			}
+		}
+
+		for ( int j = 0; j < id_count; ++j )
+			if ( counts[ j ] == 1 )
+				s->verts[ ids[ j ] ].border = 1;
+	}
+	free( ids );
+	free( counts );
+
+	for ( int i = 0; i < s->tri_count; ++i )
+	{
+		SimplifyTri* t = s->tris + i;
+		v3 p0 = s->verts[ t->v[ 0 ] ].p;
+		v3 n = SafeNorm( cross( sub( s->verts[ t->v[ 1 ] ].p, p0 ), sub( s->verts[ t->v[ 2 ] ].p, p0 ) ) );
+		t->n = n;
+		Quadric q = QuadricFromPlane( n.x, n.y, n.z, -dot( n, p0 ) );
+		for ( int j = 0; j < 3; ++j )
+			for ( int k = 0; k < 10; ++k )
+				s->verts[ t->v[ j ] ].q.m[ k ] += q.m[ k ];
+	}
+
+	for ( int i = 0; i < s->tri_count; ++i )
+		TriangleErrors( s, s->tris + i );
+}
+
+// Would moving vert i0 to p flip or sliver any of its triangles? Triangles that
+// also use i1 collapse away and are flagged in deleted.
+int SimplifyFlipped( Simplifier* s, v3 p, int i0, int i1, char* deleted )
+{
+	SimplifyVert* v0 = s->verts + i0;
+	for ( int k = 0; k < v0->tcount; ++k )
+	{
+		SimplifyRef ref = s->refs[ v0->tstart + k ];
+		SimplifyTri* t = s->tris + ref.tri;
+		if ( t->deleted ) continue;
+
+		int id1 = t->v[ (ref.corner + 1) % 3 ];
+		int id2 = t->v[ (ref.corner + 2) % 3 ];
+		if ( id1 == i1 || id2 == i1 )
+		{
+			deleted[ k ] = 1;
+			continue;
+		}
+
+		v3 d1 = SafeNorm( sub( s->verts[ id1 ].p, p ) );
+		v3 d2 = SafeNorm( sub( s->verts[ id2 ].p, p ) );
+		if ( absf( dot( d1, d2 ) ) > 0.999f ) return 1;
+		v3 n = SafeNorm( cross( d1, d2 ) );
+		deleted[ k ] = 0;
+		if ( dot( n, t->n ) < 0.2f ) return 1;
+	}
+
+	return 0;
+}
+
+// Points the triangles of v at i0 after a collapse, or deletes them.
+void SimplifyRetarget( Simplifier* s, int i0, int v, char* deleted )
+{
+	int tstart = s->verts[ v ].tstart;
+	int tcount = s->verts[ v ].tcount;
+	for ( int k = 0; k < tcount; ++k )
+	{
+		SimplifyRef ref = s->refs[ tstart + k ];
+		SimplifyTri* t = s->tris + ref.tri;
+		if ( t->deleted ) continue;
+
+		if ( deleted[ k ] )
+		{
+			t->deleted = 1;
+			s->live_tri_count--;
+			continue;
+		}
+
+		t->v[ ref.corner ] = i0;
+		t->dirty = 1;
+		TriangleErrors( s, t );
+		PushSimplifyRef( s, ref );
+	}
+}
+
+void SimplifyScratch( Simplifier* s, int count )
+{
+	if ( count <= s->scratch_capacity ) return;
+	s->scratch_capacity = count * 2;
+	s->deleted0 = (char*)realloc( s->deleted0, s->scratch_capacity );
+	s->deleted1 = (char*)realloc( s->deleted1, s->scratch_capacity );
+}
+
+// Collapses edges until at most target triangles are left or the error gets too big.
+void Simplify( Simplifier* s, int target )
+{
+	for ( int iteration = 0; iteration < 100 && s->live_tri_count > target; ++iteration )
+	{
+		if ( iteration % 5 == 0 ) SimplifyUpdate( s, 0 );
+
+		for ( int i = 0; i < s->tri_count; ++i ) s->tris[ i ].dirty = 0;
+
+		// grows with the pass, small edges go first
+		double threshold = 0.000000001 * pow( (double)(iteration + 3), 7.0 );
+
+		for ( int i = 0; i < s->tri_count && s->live_tri_count > target; ++i )
+		{
+			SimplifyTri* t = s->tris + i;
+			if ( t->err[ 3 ] > threshold || t->deleted || t->dirty ) continue;
+
+			for ( int j = 0; j < 3; ++j )
+			{
+				if ( t->err[ j ] >= threshold ) continue;
+
+				int i0 = t->v[ j ];
+				int i1 = t->v[ (j + 1) % 3 ];
+				if ( s->verts[ i0 ].border != s->verts[ i1 ].border ) continue;
+
+				v3 p;
+				EdgeError( s, i0, i1, &p );
+				SimplifyScratch( s, s->verts[ i0 ].tcount > s->verts[ i1 ].tcount ? s->verts[ i0 ].tcount : s->verts[ i1 ].tcount );
+				if ( SimplifyFlipped( s, p, i0, i1, s->deleted0 ) ) continue;
+				if ( SimplifyFlipped( s, p, i1, i0, s->deleted1 ) ) continue;
+
+				SimplifyVert* v0 = s->verts + i0;
+				SimplifyVert* v1 = s->verts + i1;
+				v0->p = p;
+				for ( int k = 0; k < 10; ++k ) v0->q.m[ k ] += v1->q.m[ k ];
+
+				int tstart = s->ref_count;
+				SimplifyRetarget( s, i0, i0, s->deleted0 );
+				SimplifyRetarget( s, i0, i1, s->deleted1 );
+				int tcount = s->ref_count - tstart;
+
+				// reuse the old refs of i0 when the new ones fit
+				v0 = s->verts + i0;
+				if ( tcount <= v0->tcount )
+				{
+					if ( tcount ) memmove( s->refs + v0->tstart, s->refs + tstart, sizeof( SimplifyRef ) * tcount );
+					s->ref_count = tstart;
+				}
+				else v0->tstart = tstart;
+				v0->tcount = tcount;
+				break;
+			}
+		}
+	}
+}
+
+// Welds the positions of a triangle soup into an indexed mesh for Simplify.
+void MakeSimplifier( Simplifier* s, Vertex* verts, int vert_count )
+{
+	int tri_count = vert_count / 3;
+	int table_size = 1;
+	while ( table_size < vert_count * 2 ) table_size *= 2;
+	int* table = (int*)malloc( sizeof( int ) * table_size );
+	for ( int i = 0; i < table_size; ++i ) table[ i ] = -1;
+
+	memset( s, 0, sizeof( Simplifier ) );
+	s->verts = (SimplifyVert*)calloc( vert_count, sizeof( SimplifyVert ) );
+	s->tris = (SimplifyTri*)calloc( tri_count, sizeof( SimplifyTri ) );
+	s->ref_capacity = tri_count * 3 + 1;
+	s->refs = (SimplifyRef*)malloc( sizeof( SimplifyRef ) * s->ref_capacity );
+
+	for ( int i = 0; i < tri_count * 3; ++i )
+	{
+		v3 p = verts[ i ].position;
+		uint32_t bits[ 3 ];
+		memcpy( bits, &p, sizeof( bits ) );
+		uint32_t slot = (bits[ 0 ] * 73856093u ^ bits[ 1 ] * 19349663u ^ bits[ 2 ] * 83492791u) & (table_size - 1);
+
+		while ( table[ slot ] != -1 )
+		{
+			v3 q = s->verts[ table[ slot ] ].p;
+			if ( q.x == p.x && q.y == p.y && q.z == p.z ) break;
+			slot = (slot + 1) & (table_size - 1);
+		}
+
+		if ( table[ slot ] == -1 )
+		{
+			table[ slot ] = s->vert_count;
+			s->verts[ s->vert_count ].p = p;
+			s->verts[ s->vert_count ].color = verts[ i ].color;
+			s->vert_count++;
+		}
+
+		s->tris[ i / 3 ].v[ i % 3 ] = table[ slot ];
+	}
+
+	free( table );
+	s->tri_count = tri_count;
+	s->live_tri_count = tri_count;
+	SimplifyUpdate( s, 1 );
+}
+
+void FreeSimplifier( Simplifier* s )
+{
+	free( s->verts );
+	free( s->tris );
+	free( s->refs );
+	free( s->deleted0 );
+	free( s->deleted1 );
+}
+
+// Back to a flat shaded triangle soup for AddMesh. Returns the vert count.
+int SimplifierVerts( Simplifier* s, Vertex* out )
+{
+	int count = 0;
+	for ( int i = 0; i < s->tri_count; ++i )
+	{
+		SimplifyTri* t = s->tris + i;
+		if ( t->deleted ) continue;
+
+		for ( int j = 0; j < 3; ++j )
+		{
+			SimplifyVert* v = s->verts + t->v[ j ];
+			out[ count ].position = v->p;
+			out[ count ].color = v->color;
+			out[ count ].normal = V3( 0, 1, 0 );
+			++count;
+		}
+	}
+	return count;
+}
+
+// Meshes with fewer faces than this are cheap enough to always draw in full.
+#define LOD_MIN_FACES 128
+
+// Builds the coarser levels of detail for a mesh, each with half the triangles
+// of the one before. Stops early once simplifying stops paying off.
+void MakeMeshLods( int handle )
+{
+	Mesh* mesh = meshes.meshes + handle;
+	if ( mesh->face_count < LOD_MIN_FACES ) return;
+
+	int vert_count = mesh->vert_count;
+	Vertex* verts = (Vertex*)malloc( sizeof( Vertex ) * vert_count );
+	Simplifier s;
+	MakeSimplifier( &s, mesh->verts, vert_count );
+	int faces = mesh->face_count;
+
+	for ( int level = 1; level < MESH_MAX_LODS; ++level )
+	{
+		Simplify( &s, faces / 2 );
+		if ( s.live_tri_count > faces * 3 / 4 ) break;
+		faces = s.live_tri_count;
+
+		char name[ 256 ];
+		snprintf( name, sizeof( name ), "%s#lod%d", meshes.mesh_names[ handle ], level );
+		int lod = AddMesh( name, verts, SimplifierVerts( &s, verts ) );
+
+		// AddMesh can move the meshes array
+		mesh = meshes.meshes + handle;
+		mesh->lods[ mesh->lod_count++ ] = lod;
+		if ( faces < LOD_MIN_FACES ) break;
+	}
+
+	FreeSimplifier( &s );
+	free( verts );
+}
+
+// Returns the mesh handle, the same one as before when replacing a mesh. Heavy
+// meshes also get their levels of detail built here, see MakeMeshLods.
+int PushMesh( lua_State *L )
+{
+	LUA_ERROR_IF( L, lua_gettop( L ) != 1, "PushMesh expects 1 parameters, a string" );
+	const char* name = luaL_checkstring( L, -1 );
+	int i = AddMesh( name, meshes.temp_verts, meshes.temp_count );
+	meshes.temp_count = 0;
+	MakeMeshLods( i );
+	lua_settop( L, 0 );
+	lua_pushinteger( L, i );
+	return 1;
+}
+
+int FlushVerts( lua_State *L )
+{
+	LUA_ERROR_IF( L, lua_gettop( L ) != 1, "PushMesh expects 1 parameters, a string" );
+	const char* name = luaL_checkstring( L, -1 );
+	lua_settop( L, 0 );
+	int index = FindRender( name );
+	PushStagedVerts( index, meshes.temp_verts, meshes.temp_count );
+	meshes.temp_count = 0;
+	return 0;
+}
+
+void PushVert( Vertex v )
+{
+	if ( meshes.temp_count == meshes.temp_capacity )
+	{
+		int new_cap = meshes.temp_capacity * 2;
+		Vertex* new_verts = (Vertex*)malloc( sizeof( Vertex ) * new_cap );
+		memcpy( new_verts, meshes.temp_verts, sizeof( Vertex ) * meshes.temp_count );
+		free( meshes.temp_verts );
+		meshes.temp_capacity = new_cap;
+		meshes.temp_verts = new_verts;
+	}
+	meshes.temp_verts[ meshes.temp_count++ ] = v;
+}
+
+int PushVert_internal( lua_State *L )
+{
+	LUA_ERROR_IF( L, lua_gettop( L ) != 9, "PushVert_internal expects 9 parameters, all floats" );
+	float x = (float)luaL_checknumber( L, -9 );
+	float y = (float)luaL_checknumber( L, -8 );
+	float z = (float)luaL_checknumber( L, -7 );
+	float cx = (float)luaL_checknumber( L, -6 );
+	float cy = (float)luaL_checknumber( L, -5 );
+	float cz = (float)luaL_checknumber( L, -4 );
+	float nx = (float)luaL_checknumber( L, -3 );
+	float ny = (float)luaL_checknumber( L, -2 );
+	float nz = (float)luaL_checknumber( L, -1 );
+	lua_settop( L, 0 );
+	Vertex v;
+	v.position = V3( x, y, z );
+	v.color = V3( cx, cy, cz );
+	v.normal = V3( nx, ny, nz );
+	PushVert( v );
+	return 0;
+}
+
+#define Register( L, func ) Register_internal( L, func, #func )
+void Register_internal( lua_State *L, lua_CFunction func, const char* name )
+{
+	lua_pushcfunction( L, func );
+	lua_setglobal( L, name );
+}
+
+int FindRender( const char* name )
+{
+	int index = NameTableFind( &meshes.render_table, name );
+	if ( index == -1 )
+	{
+		ERROR_IF( 0, "SetRender could not find %s", name );
+		return 0;
+	}
+	return index;
+}
+
+int FindMesh(const char* name)
+{
+	return NameTableFind( &meshes.mesh_table, name );
+}
+
+// Lua may pass either a handle or a name. Handles skip the lookup entirely.
+int CheckRender( lua_State* L, int index )
+{
+	if ( lua_type( L, index ) == LUA_TNUMBER )
+	{
+		int render = (int)lua_tointeger( L, index );
+		luaL_argcheck( L, render >= 0 && render < meshes.render_count, index, "invalid render handle" );
+		return render;
+	}
+	return FindRender( luaL_checkstring( L, index ) );
+}
+
+int CheckMesh( lua_State* L, int index )
+{
+	if ( lua_type( L, index ) == LUA_TNUMBER )
+	{
+		int mesh = (int)lua_tointeger( L, index );
+		luaL_argcheck( L, mesh >= 0 && mesh < meshes.mesh_count, index, "invalid mesh handle" );
+		return mesh;
+	}
+	return FindMesh( luaL_checkstring( L, index ) );
+}
+
+int GetMesh( lua_State* L )
+{
+	LUA_ERROR_IF( L, lua_gettop( L ) != 1, "GetMesh expects 1 parameter, a string" );
+	int mesh = FindMesh( luaL_checkstring( L, 1 ) );
+	lua_settop( L, 0 );
+	if ( mesh == -1 ) lua_pushnil( L );
+	else lua_pushinteger( L, mesh );
+	return 1;
+}
+
+int GetRender( lua_State* L )
+{
+	LUA_ERROR_IF( L, lua_gettop( L ) != 1, "GetRender expects 1 parameter, a string" );
+	int render = NameTableFind( &meshes.render_table, luaL_checkstring( L, 1 ) );
+	lua_settop( L, 0 );
+	if ( render == -1 ) lua_pushnil( L );
+	else lua_pushinteger( L, render );
+	return 1;
+}
+
+// Instance expansion kernels. Each one writes mesh->vert_count transformed
+// verts to out: positions are rotated, scaled then offset by p, and the face
+// normals are rotated, divided by the scale (inverse transpose) and
+// renormalized. The SIMD kernels run over the SoA arrays EXPAND_BLOCK or
+// fewer lanes at a time and scatter the valid lanes back out to StreamVertex.
+typedef void (*ExpandInstanceFunc)( Mesh* mesh, StreamVertex* out, v3 p, v3 scale, m3 r );
+
+void ExpandInstance_Scalar( Mesh* mesh, StreamVertex* out, v3 p, v3 scale, m3 r )
+{
+	for ( int i = 0; i < mesh->vert_count; ++i )
+	{
+		v3 v = V3( mesh->px[ i ], mesh->py[ i ], mesh->pz[ i ] );
+		v = v3Mul( r, v );
+		out[ i ].position = V3( v.x * scale.x + p.x, v.y * scale.y + p.y, v.z * scale.z + p.z );
+		out[ i ].color = mesh->colors[ i ];
+	}
+
+	for ( int i = 0; i < mesh->face_count; ++i )
+	{
+		v3 n = v3Mul( r, V3( mesh->nx[ i ], mesh->ny[ i ], mesh->nz[ i ] ) );
+		uint32_t packed = PackNormal( norm( V3( n.x / scale.x, n.y / scale.y, n.z / scale.z ) ) );
+		out[ i * 3 ].normal = packed;
+		out[ i * 3 + 1 ].normal = packed;
+		out[ i * 3 + 2 ].normal = packed;
+	}
+}
+
+#if POOK_X86
+
+void ExpandInstance_SSE( Mesh* mesh, StreamVertex* out, v3 p, v3 scale, m3 r )
+{
+	__m128 r00 = _mm_set1_ps( r.x.x ), r01 = _mm_set1_ps( r.x.y ), r02 = _mm_set1_ps( r.x.z );
+	__m128 r10 = _mm_set1_ps( r.y.x ), r11 = _mm_set1_ps( r.y.y ), r12 = _mm_set1_ps( r.y.z );
+	__m128 r20 = _mm_set1_ps( r.z.x ), r21 = _mm_set1_ps( r.z.y ), r22 = _mm_set1_ps( r.z.z );
+	__m128 sx = _mm_set1_ps( scale.x ), sy = _mm_set1_ps( scale.y ), sz = _mm_set1_ps( scale.z );
+	__m128 px = _mm_set1_ps( p.x ), py = _mm_set1_ps( p.y ), pz = _mm_set1_ps( p.z );
+	__m128 one = _mm_set1_ps( 1.0f );
+	float lanes[ 3 ][ 4 ];
+
+	for ( int i = 0; i < mesh->vert_count; i += 4 )
+	{
+		__m128 x = _mm_loadu_ps( mesh->px + i );
+		__m128 y = _mm_loadu_ps( mesh->py + i );
+		__m128 z = _mm_loadu_ps( mesh->pz + i );
+		__m128 tx = _mm_add_ps( _mm_add_ps( _mm_mul_ps( r00, x ), _mm_mul_ps( r01, y ) ), _mm_mul_ps( r02, z ) );
+		__m128 ty = _mm_add_ps( _mm_add_ps( _mm_mul_ps( r10, x ), _mm_mul_ps( r11, y ) ), _mm_mul_ps( r12, z ) );
+		__m128 tz = _mm_add_ps( _mm_add_ps( _mm_mul_ps( r20, x ), _mm_mul_ps( r21, y ) ), _mm_mul_ps( r22, z ) );
+		_mm_storeu_ps( lanes[ 0 ], _mm_add_ps( _mm_mul_ps( tx, sx ), px ) );
+		_mm_storeu_ps( lanes[ 1 ], _mm_add_ps( _mm_mul_ps( ty, sy ), py ) );
+		_mm_storeu_ps( lanes[ 2 ], _mm_add_ps( _mm_mul_ps( tz, sz ), pz ) );
+
+		int count = mesh->vert_count - i < 4 ? mesh->vert_count - i : 4;
+		for ( int j = 0; j < count; ++j )
+		{
+			out[ i + j ].position = V3( lanes[ 0 ][ j ], lanes[ 1 ][ j ], lanes[ 2 ][ j ] );
+			out[ i + j ].color = mesh->colors[ i + j ];
+		}
+	}
+
+	for ( int i = 0; i < mesh->face_count; i += 4 )
+	{
+		__m128 x = _mm_loadu_ps( mesh->nx + i );
+		__m128 y = _mm_loadu_ps( mesh->ny + i );
+		__m128 z = _mm_loadu_ps( mesh->nz + i );
+		__m128 nx = _mm_div_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( r00, x ), _mm_mul_ps( r01, y ) ), _mm_mul_ps( r02, z ) ), sx );
+		__m128 ny = _mm_div_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( r10, x ), _mm_mul_ps( r11, y ) ), _mm_mul_ps( r12, z ) ), sy );
+		__m128 nz = _mm_div_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( r20, x ), _mm_mul_ps( r21, y ) ), _mm_mul_ps( r22, z ) ), sz );
+		__m128 len2 = _mm_add_ps( _mm_add_ps( _mm_mul_ps( nx, nx ), _mm_mul_ps( ny, ny ) ), _mm_mul_ps( nz, nz ) );
+		__m128 inv_len = _mm_div_ps( one, _mm_sqrt_ps( len2 ) );
+		_mm_storeu_ps( lanes[ 0 ], _mm_mul_ps( inv_len, nx ) );
+		_mm_storeu_ps( lanes[ 1 ], _mm_mul_ps( inv_len, ny ) );
+		_mm_storeu_ps( lanes[ 2 ], _mm_mul_ps( inv_len, nz ) );
+
+		int count = mesh->face_count - i < 4 ? mesh->face_count - i : 4;
+		for ( int j = 0; j < count; ++j )
+		{
+			uint32_t n = PackNormal( V3( lanes[ 0 ][ j ], lanes[ 1 ][ j ], lanes[ 2 ][ j ] ) );
+			StreamVertex* v = out + (i + j) * 3;
+			v[ 0 ].normal = n;
+			v[ 1 ].normal = n;
+			v[ 2 ].normal = n;
+		}
+	}
+}
+
+POOK_TARGET_AVX void ExpandInstance_AVX( Mesh* mesh, StreamVertex* out, v3 p, v3 scale, m3 r )
+{
+	__m256 r00 = _mm256_set1_ps( r.x.x ), r01 = _mm256_set1_ps( r.x.y ), r02 = _mm256_set1_ps( r.x.z );
+	__m256 r10 = _mm256_set1_ps( r.y.x ), r11 = _mm256_set1_ps( r.y.y ), r12 = _mm256_set1_ps( r.y.z );
+	__m256 r20 = _mm256_set1_ps( r.z.x ), r21 = _mm256_set1_ps( r.z.y ), r22 = _mm256_set1_ps( r.z.z );
+	__m256 sx = _mm256_set1_ps( scale.x ), sy = _mm256_set1_ps( scale.y ), sz = _mm256_set1_ps( scale.z );
+	__m256 px = _mm256_set1_ps( p.x ), py = _mm256_set1_ps( p.y ), pz = _mm256_set1_ps( p.z );
+	__m256 one = _mm256_set1_ps( 1.0f );
+	float lanes[ 3 ][ 8 ];
+
+	for ( int i = 0; i < mesh->vert_count; i += 8 )
+	{
+		__m256 x = _mm256_loadu_ps( mesh->px + i );
+		__m256 y = _mm256_loadu_ps( mesh->py + i );
+		__m256 z = _mm256_loadu_ps( mesh->pz + i );
+		__m256 tx = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( r00, x ), _mm256_mul_ps( r01, y ) ), _mm256_mul_ps( r02, z ) );
+		__m256 ty = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( r10, x ), _mm256_mul_ps( r11, y ) ), _mm256_mul_ps( r12, z ) );
+		__m256 tz = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( r20, x ), _mm256_mul_ps( r21, y ) ), _mm256_mul_ps( r22, z ) );
+		_mm256_storeu_ps( lanes[ 0 ], _mm256_add_ps( _mm256_mul_ps( tx, sx ), px ) );
+		_mm256_storeu_ps( lanes[ 1 ], _mm256_add_ps( _mm256_mul_ps( ty, sy ), py ) );
+		_mm256_storeu_ps( lanes[ 2 ], _mm256_add_ps( _mm256_mul_ps( tz, sz ), pz ) );
+
+		int count = mesh->vert_count - i < 8 ? mesh->vert_count - i : 8;
+		for ( int j = 0; j < count; ++j )
+		{
+			out[ i + j ].position = V3( lanes[ 0 ][ j ], lanes[ 1 ][ j ], lanes[ 2 ][ j ] );
+			out[ i + j ].color = mesh->colors[ i + j ];
+		}
+	}
+
+	for ( int i = 0; i < mesh->face_count; i += 8 )
+	{
+		__m256 x = _mm256_loadu_ps( mesh->nx + i );
+		__m256 y = _mm256_loadu_ps( mesh->ny + i );
+		__m256 z = _mm256_loadu_ps( mesh->nz + i );
+		__m256 nx = _mm256_div_ps( _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( r00, x ), _mm256_mul_ps( r01, y ) ), _mm256_mul_ps( r02, z ) ), sx );
+		__m256 ny = _mm256_div_ps( _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( r10, x ), _mm256_mul_ps( r11, y ) ), _mm256_mul_ps( r12, z ) ), sy );
+		__m256 nz = _mm256_div_ps( _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( r20, x ), _mm256_mul_ps( r21, y ) ), _mm256_mul_ps( r22, z ) ), sz );
+		__m256 len2 = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( nx, nx ), _mm256_mul_ps( ny, ny ) ), _mm256_mul_ps( nz, nz ) );
+		__m256 inv_len = _mm256_div_ps( one, _mm256_sqrt_ps( len2 ) );
+		_mm256_storeu_ps( lanes[ 0 ], _mm256_mul_ps( inv_len, nx ) );
+		_mm256_storeu_ps( lanes[ 1 ], _mm256_mul_ps( inv_len, ny ) );
+		_mm256_storeu_ps( lanes[ 2 ], _mm256_mul_ps( inv_len, nz ) );
+
+		int count = mesh->face_count - i < 8 ? mesh->face_count - i : 8;
+		for ( int j = 0; j < count; ++j )
+		{
+			uint32_t n = PackNormal( V3( lanes[ 0 ][ j ], lanes[ 1 ][ j ], lanes[ 2 ][ j ] ) );
+			StreamVertex* v = out + (i + j) * 3;
+			v[ 0 ].normal = n;
+			v[ 1 ].normal = n;
+			v[ 2 ].normal = n;
+		}
+	}
+}
+
+// AVX needs both the CPU bit and the OS saving ymm state (OSXSAVE + XCR0).
+int CpuHasAVX( )
+{
+	unsigned ecx;
+	unsigned long long xcr0;
+#if defined( _MSC_VER )
+	int info[ 4 ];
+	__cpuid( info, 1 );
+	ecx = (unsigned)info[ 2 ];
+	if ( !(ecx & (1 << 27)) || !(ecx & (1 << 28)) ) return 0;
+	xcr0 = _xgetbv( 0 );
+#else
+	unsigned eax, ebx, edx;
+	if ( !__get_cpuid( 1, &eax, &ebx, &ecx, &edx ) ) return 0;
+	if ( !(ecx & (1 << 27)) || !(ecx & (1 << 28)) ) return 0;
+	unsigned lo, hi;
+	__asm__ volatile ( "xgetbv" : "=a"( lo ), "=d"( hi ) : "c"( 0 ) );
+	xcr0 = ((unsigned long long)hi << 32) | lo;
+#endif
+	return (xcr0 & 6) == 6;
+}
+
+int CpuHasSSE2( )
+{
+#if defined( _MSC_VER )
+	int info[ 4 ];
+	__cpuid( info, 1 );
+	unsigned edx = (unsigned)info[ 3 ];
+#else
+	unsigned eax, ebx, ecx, edx;
+	if ( !__get_cpuid( 1, &eax, &ebx, &ecx, &edx ) ) return 0;
+#endif
+	return (edx & (1 << 26)) != 0;
+}
+
+#endif
+
+ExpandInstanceFunc ExpandInstance = ExpandInstance_Scalar;
+
+void InitExpandInstance( )
+{
+#if POOK_X86
+	if ( CpuHasAVX( ) ) ExpandInstance = ExpandInstance_AVX;
+	else if ( CpuHasSSE2( ) ) ExpandInstance = ExpandInstance_SSE;
+#endif
+}
+
+void ReserveVerts( DrawCall* call, int count )
+{
+	if ( call->count + count <= call->capacity ) return;
+	int new_cap = call->capacity * 2;
+	while ( new_cap < call->count + count ) new_cap *= 2;
+	StreamVertex* new_verts = (StreamVertex*)malloc( sizeof( StreamVertex ) * new_cap );
+	memcpy( new_verts, call->verts, sizeof( StreamVertex ) * call->count );
+	free( call->verts );
+	call->capacity = new_cap;
+	call->verts = new_verts;
+}
+
+// CPU geometry expansion is deferred. Submissions only record a job and reserve
+// the exact range of verts the job will write in its DrawCall, so the DrawCall's
+// vertex order is the submission order no matter which thread fills in a range.
+// RunExpandJobs then spreads the jobs over a pool of worker threads once per
+// frame, before the draw calls are pushed.
+//
+// With ZERO_COPY_STREAMING the reserved ranges live in the renderable's mapped
+// ring buffer instead of DrawCall::verts. Jobs write transformed verts straight
+// into driver memory, which skips tinygl's copy in tgDoMap and never grows the
+// DrawCall arrays.
+#define ZERO_COPY_STREAMING 1
+
+typedef struct ExpandJob ExpandJob;
+typedef void (*ExpandJobFunc)( ExpandJob* job, StreamVertex* out );
+
+struct ExpandJob
+{
+	ExpandJobFunc func;
+	int call;
+	int first;
+	int count;
+
+	// instance jobs
+	int mesh;
+	v3 p;
+	v3 scale;
+	m3 r;
+
+	// wave jobs
+	int particle0;
+	int particle1;
+
+	// staged vert jobs, offset into ExpandPool::staged
+	int src;
+};
+
+#ifdef _WIN32
+	typedef HANDLE Semaphore;
+	void SemaphoreInit( Semaphore* s ) { *s = CreateSemaphore( NULL, 0, 0x7FFFFFFF, NULL ); }
+	void SemaphoreFree( Semaphore* s ) { CloseHandle( *s ); }
+	void SemaphorePost( Semaphore* s, int count ) { ReleaseSemaphore( *s, count, NULL ); }
+	void SemaphoreWait( Semaphore* s ) { WaitForSingleObject( *s, INFINITE ); }
+	int AtomicIncrement( volatile int* i ) { return (int)InterlockedIncrement( (volatile LONG*)i ); }
+	int CoreCount( ) { SYSTEM_INFO info; GetSystemInfo( &info ); return (int)info.dwNumberOfProcessors; }
+#else
+	#include <pthread.h>
+	#include <unistd.h>
+	typedef struct
+	{
+		pthread_mutex_t lock;
+		pthread_cond_t cond;
+		int count;
+	} Semaphore;
+
+	void SemaphoreInit( Semaphore* s ) { pthread_mutex_init( &s->lock, NULL ); pthread_cond_init( &s->cond, NULL ); s->count = 0; }
+	void SemaphoreFree( Semaphore* s ) { pthread_mutex_destroy( &s->lock ); pthread_cond_destroy( &s->cond ); }
+	int AtomicIncrement( volatile int* i ) { return __sync_add_and_fetch( i, 1 ); }
+	int CoreCount( ) { return (int)sysconf( _SC_NPROCESSORS_ONLN ); }
+
+	void SemaphorePost( Semaphore* s, int count )
+	{
+		pthread_mutex_lock( &s->lock );
+		s->count += count;
+		pthread_cond_broadcast( &s->cond );
+		pthread_mutex_unlock( &s->lock );
+	}
+
+	void SemaphoreWait( Semaphore* s )
+	{
+		pthread_mutex_lock( &s->lock );
+		while ( !s->count ) pthread_cond_wait( &s->cond, &s->lock );
+		--s->count;
+		pthread_mutex_unlock( &s->lock );
+	}
+#endif
+
+#define MAX_EXPAND_WORKERS 15
+
+// below this many verts waking the workers costs more than it saves
+#define EXPAND_PARALLEL_MIN_VERTS (1024 * 8)
+
+// Besides expansion jobs the pool runs plain parallel loops. RunPoolTasks calls
+// func( i ) once for every i in [0, count) spread over the workers, and returns
+// once all of them are done.
+typedef void (*PoolTaskFunc)( int index );
+
+typedef struct
+{
+	int job_count;
+	int job_capacity;
+	ExpandJob* jobs;
+	int vert_count;
+
+	// verts pushed from Lua, copied in by their jobs
+	int staged_count;
+	int staged_capacity;
+	Vertex* staged;
+
+	volatile int next_job;
+	volatile int quit;
+
+	// set while RunPoolTasks runs, workers then run tasks instead of jobs
+	PoolTaskFunc task;
+	int task_count;
+
+	int worker_count;
+	Semaphore start;
+	Semaphore finished;
+} ExpandPool;
+
+ExpandPool expand_pool;
+
+void RunExpandJobs_internal( )
+{
+	while ( 1 )
+	{
+		int i = AtomicIncrement( &expand_pool.next_job ) - 1;
+		if ( i >= expand_pool.job_count ) break;
+		ExpandJob* job = expand_pool.jobs + i;
+#if ZERO_COPY_STREAMING
+		job->func( job, meshes.calls[ job->call ].mapped + job->first );
+#else
+		job->func( job, meshes.calls[ job->call ].verts + job->first );
+#endif
+	}
+}
+
+void RunPoolTasks_internal( )
+{
+	while ( 1 )
+	{
+		int i = AtomicIncrement( &expand_pool.next_job ) - 1;
+		if ( i >= expand_pool.task_count ) break;
+		expand_pool.task( i );
+	}
+}
+
+#ifdef _WIN32
+	DWORD WINAPI ExpandWorker( LPVOID param )
+#else
+	void* ExpandWorker( void* param )
+#endif
+{
+	while ( 1 )
+	{
+		SemaphoreWait( &expand_pool.start );
+		if ( expand_pool.quit ) break;
+		if ( expand_pool.task ) RunPoolTasks_internal( );
+		else RunExpandJobs_internal( );
+		SemaphorePost( &expand_pool.finished, 1 );
+	}
+	return 0;
+}
+
+void InitExpandWorkers( )
+{
+	expand_pool.job_capacity = 1024;
+	expand_pool.jobs = (ExpandJob*)malloc( sizeof( ExpandJob ) * expand_pool.job_capacity );
+	expand_pool.staged_capacity = 1024;
+	expand_pool.staged = (Vertex*)malloc( sizeof( Vertex ) * expand_pool.staged_capacity );
+	SemaphoreInit( &expand_pool.start );
+	SemaphoreInit( &expand_pool.finished );
+
+	// the main thread works too
+	int worker_count = CoreCount( ) - 1;
+	expand_pool.worker_count = worker_count < 0 ? 0 : worker_count > MAX_EXPAND_WORKERS ? MAX_EXPAND_WORKERS : worker_count;
+
+	for ( int i = 0; i < expand_pool.worker_count; ++i )
+	{
+#ifdef _WIN32
+		CloseHandle( CreateThread( NULL, 0, ExpandWorker, NULL, 0, NULL ) );
+#else
+		pthread_t thread;
+		pthread_create( &thread, NULL, ExpandWorker, NULL );
+		pthread_detach( thread );
+#endif
+	}
+}
+
+void RunPoolTasks( PoolTaskFunc func, int count )
+{
+	expand_pool.task = func;
+	expand_pool.task_count = count;
+	expand_pool.next_job = 0;
+
+	if ( expand_pool.worker_count && count > 1 )
+	{
+		SemaphorePost( &expand_pool.start, expand_pool.worker_count );
+		RunPoolTasks_internal( );
+		for ( int i = 0; i < expand_pool.worker_count; ++i )
+			SemaphoreWait( &expand_pool.finished );
+	}
+
+	else RunPoolTasks_internal( );
+
+	expand_pool.task = 0;
+}
+
+void FreeExpandWorkers( )
+{
+	expand_pool.quit = 1;
+	SemaphorePost( &expand_pool.start, expand_pool.worker_count );
+	free( expand_pool.jobs );
+	free( expand_pool.staged );
+}
+
+// Returns a job covering count verts reserved at the end of the render's DrawCall.
+// Only valid until the next PushExpandJob.
+ExpandJob* PushExpandJob( ExpandJobFunc func, int render, int count )
+{
+	DrawCall* call = meshes.calls + render;
+
+	if ( expand_pool.job_count == expand_pool.job_capacity )
+	{
+		int new_cap = expand_pool.job_capacity * 2;
+		ExpandJob* new_jobs = (ExpandJob*)malloc( sizeof( ExpandJob ) * new_cap );
+		memcpy( new_jobs, expand_pool.jobs, sizeof( ExpandJob ) * expand_pool.job_count );
+		free( expand_pool.jobs );
+		expand_pool.job_capacity = new_cap;
+		expand_pool.jobs = new_jobs;
+	}
+
+#if !ZERO_COPY_STREAMING
+	ReserveVerts( call, count );
+#endif
+	ExpandJob* job = expand_pool.jobs + expand_pool.job_count++;
+	job->func = func;
+	job->call = render;
+	job->first = call->count;
+	job->count = count;
+	call->count += count;
+	expand_pool.vert_count += count;
+	return job;
+}
+
+void RunExpandJobs( )
+{
+	expand_pool.next_job = 0;
+
+#if ZERO_COPY_STREAMING
+	for ( int i = 0; i < meshes.render_count; ++i )
+	{
+		DrawCall* call = meshes.calls + i;
+		if ( call->count ) call->mapped = (StreamVertex*)tgMap( &call->r, call->count );
+	}
+#endif
+
+	if ( expand_pool.worker_count && expand_pool.vert_count >= EXPAND_PARALLEL_MIN_VERTS )
+	{
+		SemaphorePost( &expand_pool.start, expand_pool.worker_count );
+		RunExpandJobs_internal( );
+		for ( int i = 0; i < expand_pool.worker_count; ++i )
+			SemaphoreWait( &expand_pool.finished );
+	}
+
+	else RunExpandJobs_internal( );
+
+#if ZERO_COPY_STREAMING
+	for ( int i = 0; i < meshes.render_count; ++i )
+	{
+		DrawCall* call = meshes.calls + i;
+		if ( call->count ) tgUnmapRenderable( &call->r );
+		call->mapped = 0;
+	}
+#endif
+
+	expand_pool.job_count = 0;
+	expand_pool.vert_count = 0;
+	expand_pool.staged_count = 0;
+}
+
+void ExpandInstanceJob( ExpandJob* job, StreamVertex* out )
+{
+	ExpandInstance( meshes.meshes + job->mesh, out, job->p, job->scale, job->r );
+}
+
+void CopyStagedJob( ExpandJob* job, StreamVertex* out )
+{
+	Vertex* staged = expand_pool.staged + job->src;
+	for ( int i = 0; i < job->count; ++i )
+		out[ i ] = PackStreamVertex( staged + i );
+}
+
+void PushStagedVerts( int render, Vertex* verts, int count )
+{
+	if ( !count ) return;
+
+	if ( expand_pool.staged_count + count > expand_pool.staged_capacity )
+	{
+		int new_cap = expand_pool.staged_capacity * 2;
+		while ( new_cap < expand_pool.staged_count + count ) new_cap *= 2;
+		Vertex* new_staged = (Vertex*)malloc( sizeof( Vertex ) * new_cap );
+		memcpy( new_staged, expand_pool.staged, sizeof( Vertex ) * expand_pool.staged_count );
+		free( expand_pool.staged );
+		expand_pool.staged_capacity = new_cap;
+		expand_pool.staged = new_staged;
+	}
+
+	ExpandJob* job = PushExpandJob( CopyStagedJob, render, count );
+	job->src = expand_pool.staged_count;
+	memcpy( expand_pool.staged + expand_pool.staged_count, verts, sizeof( Vertex ) * count );
+	expand_pool.staged_count += count;
+}
+
+// distance in front of the camera along its view direction
+float ViewDepth( v3 p )
+{
+	return -(cam[ 2 ] * p.x + cam[ 6 ] * p.y + cam[ 10 ] * p.z + cam[ 14 ]);
+}
+
+// Projected diameter, as a fraction of the screen height, under which an
+// instance drops to its first coarser level of detail. Each further level
+// kicks in at half the size of the one before.
+#define LOD_SCREEN_SIZE 0.08f
+
+// Picks the mesh handle to draw an instance of handle with: -1 when its
+// bounding sphere is outside the frustum of the current mvp, otherwise the
+// level of detail that fits how big the sphere is on screen. Verts are rotated,
+// scaled and then offset, like ExpandInstance and simple.vs do, and the radius
+// grows by the largest scale to cover non-uniform scaling.
+int SelectInstanceMesh( int handle, v3 p, v3 scale, m3 r )
+{
+	Mesh* mesh = meshes.meshes + handle;
+	v3 c = v3Mul( r, mesh->bound_center );
+	c = V3( c.x * scale.x + p.x, c.y * scale.y + p.y, c.z * scale.z + p.z );
+	float s = absf( scale.x );
+	if ( absf( scale.y ) > s ) s = absf( scale.y );
+	if ( absf( scale.z ) > s ) s = absf( scale.z );
+	float radius = mesh->bound_radius * s;
+
+	if ( !SphereInFrustum( c, radius ) )
+	{
+		++cull_stats.culled;
+		return -1;
+	}
+
+	++cull_stats.drawn;
+	if ( mesh->lod_count == 1 ) return handle;
+
+	// projection[ 5 ] is cot( fov / 2 ), so this is the sphere's height over half the screen's
+	float depth = ViewDepth( c );
+	if ( depth <= radius ) return handle;
+	float size = radius * projection[ 5 ] / depth;
+
+	int level = 0;
+	float threshold = LOD_SCREEN_SIZE;
+	while ( level + 1 < mesh->lod_count && size < threshold )
+	{
+		++level;
+		threshold *= 0.5f;
+	}
+
+	return mesh->lods[ level ];
+}
+
+void PushInstanceVerts( int mesh, int render, v3 p, v3 scale, m3 r )
+{
+	mesh = SelectInstanceMesh( mesh, p, scale, r );
+	if ( mesh == -1 ) return;
+
+	ExpandJob* job = PushExpandJob( ExpandInstanceJob, render, meshes.meshes[ mesh ].vert_count );
+	job->mesh = mesh;
+	job->p = p;
+	job->scale = scale;
+	job->r = r;
+}
+
+int PushInstance_internal( lua_State *L )
+{
+	LUA_ERROR_IF( L, lua_gettop( L ) != 12, "PushInstance expects 12 parameters, two strings or handles and 10 floats" );
+	int render = CheckRender( L, 1 );
+	int mesh = CheckMesh( L, 2 );
+	float x = (float)luaL_checknumber( L, -10 );
+	float y = (float)luaL_checknumber( L, -9 );
+	float z = (float)luaL_checknumber( L, -8 );
+	float sx = (float)luaL_checknumber( L, -7 );
+	float sy = (float)luaL_checknumber( L, -6 );
+	float sz = (float)luaL_checknumber( L, -5 );
+	float rx = (float)luaL_checknumber( L, -4 );
+	float ry = (float)luaL_checknumber( L, -3 );
+	float rz = (float)luaL_checknumber( L, -2 );
+	float ra = (float)luaL_checknumber( L, -1 );
+	lua_settop( L, 0 );
+	v3 p = V3( x, y, z );
+
+	if ( mesh == -1 )
+	{
+		ERROR_IF( 0, "SetRender could not find mesh" );
+		return 0;
+	}
+
+	v3 axis = V3( rx, ry, rz );
+	float angle = ra;
+	m3 r = m3Rotation( axis, angle );
+	PushInstanceVerts( mesh, render, p, V3( sx, sy, sz ), r );
+
+	return 0;
+}
+
+// Instance buffers live in Lua as flat arrays of floats, INSTANCE_FLOATS per
+// slot (see GetInstanceBuffer in graphics.lua). Entities write their transform
+// fields straight into the array, which costs no calls into C, and the whole
+// array is read with a single SubmitInstances call per mesh per frame. The C
+// side only keeps the names the buffer draws with and their cached lookups.
+#define MAX_INSTANCE_BUFFERS 256
+#define INSTANCE_BUFFER_MT "InstanceBuffer"
+
+// x, y, z, sx, sy, sz, rx, ry, rz, ra, active
+#define INSTANCE_FLOATS 11
+
+typedef struct
+{
+	char* render_name;
+	char* mesh_name;
+	int render;
+	int mesh;
+} InstanceBuffer;
+
+int instance_buffer_count;
+InstanceBuffer instance_buffers[ MAX_INSTANCE_BUFFERS ];
+
+void FreeInstanceBuffers( )
+{
+	for ( int i = 0; i < instance_buffer_count; ++i )
+	{
+		InstanceBuffer* buffer = instance_buffers + i;
+		free( buffer->render_name );
+		free( buffer->mesh_name );
+	}
+	memset( instance_buffers, 0, sizeof( instance_buffers ) );
+	instance_buffer_count = 0;
+}
+
+InstanceBuffer* CheckInstanceBuffer( lua_State* L, int index )
+{
+	return *(InstanceBuffer**)luaL_checkudata( L, index, INSTANCE_BUFFER_MT );
+}
+
+int MakeInstanceBuffer( lua_State* L )
+{
+	LUA_ERROR_IF( L, lua_gettop( L ) != 2, "MakeInstanceBuffer expects 2 parameters, a render name and a mesh name" );
+	if ( instance_buffer_count == MAX_INSTANCE_BUFFERS ) return luaL_error( L, "Hit MAX_INSTANCE_BUFFERS limit" );
+	const char* render_name = luaL_checkstring( L, -2 );
+	const char* mesh_name = luaL_checkstring( L, -1 );
+	InstanceBuffer* buffer = instance_buffers + instance_buffer_count++;
+	buffer->render_name = strdup( render_name );
+	buffer->mesh_name = strdup( mesh_name );
+
+	// renders and meshes are made after init.lua runs, so look these up lazily
+	buffer->render = -1;
+	buffer->mesh = -1;
+	lua_settop( L, 0 );
+
+	InstanceBuffer** ud = (InstanceBuffer**)lua_newuserdata( L, sizeof( InstanceBuffer* ) );
+	*ud = buffer;
+	luaL_setmetatable( L, INSTANCE_BUFFER_MT );
+	return 1;
+}
+
+// drawn, culled = GetCullStats( ), instance counts from the last frame
+int GetCullStats( lua_State* L )
+{
+	lua_settop( L, 0 );
+	lua_pushinteger( L, last_cull_stats.drawn );
+	lua_pushinteger( L, last_cull_stats.culled );
+	return 2;
+}
+
+float InstanceField( lua_State* L, int table, lua_Integer index )
+{
+	lua_rawgeti( L, table, index );
+	float f = (float)lua_tonumber( L, -1 );
+	lua_pop( L, 1 );
+	return f;
+}
+
+// SubmitInstances( buffer, floats, slot_count ), floats packed as described above
+int SubmitInstances( lua_State* L )
+{
+	LUA_ERROR_IF( L, lua_gettop( L ) != 3, "SubmitInstances expects 3 parameters, an instance buffer, its floats and its slot count" );
+	InstanceBuffer* buffer = CheckInstanceBuffer( L, 1 );
+	luaL_checktype( L, 2, LUA_TTABLE );
+	int count = (int)luaL_checkinteger( L, 3 );
+
+	if ( buffer->mesh == -1 ) buffer->mesh = FindMesh( buffer->mesh_name );
+	if ( buffer->mesh == -1 )
+	{
+		lua_settop( L, 0 );
+		return 0;
+	}
+
+	// instances are drawn straight from the static VBO of the mesh, or of the
+	// level of detail picked for them, with the simple shader, so render_name
+	// only matters to PushInstance_internal callers
+	for ( int i = 0; i < count; ++i )
+	{
+		lua_Integer o = (lua_Integer)i * INSTANCE_FLOATS;
+		if ( InstanceField( L, 2, o + INSTANCE_FLOATS ) == 0 ) continue; // active
+		v3 p = V3( InstanceField( L, 2, o + 1 ), InstanceField( L, 2, o + 2 ), InstanceField( L, 2, o + 3 ) );
+		v3 sc = V3( InstanceField( L, 2, o + 4 ), InstanceField( L, 2, o + 5 ), InstanceField( L, 2, o + 6 ) );
+		v3 axis = V3( InstanceField( L, 2, o + 7 ), InstanceField( L, 2, o + 8 ), InstanceField( L, 2, o + 9 ) );
+		float angle = InstanceField( L, 2, o + 10 );
+		int lod = SelectInstanceMesh( buffer->mesh, p, sc, m3Rotation( axis, angle ) );
+		if ( lod == -1 ) continue;
+
+		Mesh* mesh = meshes.meshes + lod;
+		if ( mesh->instance_count == INSTANCE_STREAM_SIZE ) return luaL_error( L, "Hit INSTANCE_STREAM_SIZE limit" );
+
+		if ( mesh->instance_count == mesh->instance_capacity )
+		{
+			int new_cap = mesh->instance_capacity * 2;
+			InstanceData* new_instances = (InstanceData*)malloc( sizeof( InstanceData ) * new_cap );
+			memcpy( new_instances, mesh->instances, sizeof( InstanceData ) * mesh->instance_count );
+			free( mesh->instances );
+			mesh->instance_capacity = new_cap;
+			mesh->instances = new_instances;
+		}
+
+		mesh->instances[ mesh->instance_count++ ] = MakeInstanceData( p, sc, axis, angle );
+	}
+
+	lua_settop( L, 0 );
+	return 0;
+}
+
+// the metatable only tags buffers for CheckInstanceBuffer, their methods are in graphics.lua
+void RegisterInstanceBuffer( lua_State* L )
+{
+	luaL_newmetatable( L, INSTANCE_BUFFER_MT );
+	lua_pop( L, 1 );
+}
+
+// v3 for Lua, a userdata with the API src/util/vector.lua used to implement
+// with tables. Components are lua_Numbers so scripts compute exactly what they
+// did before. Arithmetic metamethods return a new v3. The in-place methods (set,
+// add, sub, scale, addScaled, normalize) write into self and return it, so the
+// per-frame code can run without making garbage.
+#define V3_MT "v3"
+
+typedef struct
+{
+	lua_Number x;
+	lua_Number y;
+	lua_Number z;
+} LuaV3;
+
+LuaV3* CheckV3( lua_State* L, int index )
+{
+	return (LuaV3*)luaL_checkudata( L, index, V3_MT );
+}
+
+LuaV3* PushV3( lua_State* L, lua_Number x, lua_Number y, lua_Number z )
+{
+	LuaV3* v = (LuaV3*)lua_newuserdata( L, sizeof( LuaV3 ) );
+	v->x = x;
+	v->y = y;
+	v->z = z;
+	luaL_setmetatable( L, V3_MT );
+	return v;
+}
+
+// Accepts a v3 or any table with x, y and z fields.
+LuaV3 ToV3( lua_State* L, int index )
+{
+	LuaV3* v = (LuaV3*)luaL_testudata( L, index, V3_MT );
+	if ( v ) return *v;
+
+	LuaV3 r;
+	luaL_checktype( L, index, LUA_TTABLE );
+	lua_getfield( L, index, "x" );
+	lua_getfield( L, index, "y" );
+	lua_getfield( L, index, "z" );
+	r.x = lua_tonumber( L, -3 );
+	r.y = lua_tonumber( L, -2 );
+	r.z = lua_tonumber( L, -1 );
+	lua_pop( L, 3 );
+	return r;
+}
+
+// v3( x, y, z ) or v3( other ), through __call on the v3 class table
+int V3_New( lua_State* L )
+{
+	int type = lua_type( L, 2 );
+	if ( type == LUA_TTABLE || type == LUA_TUSERDATA )
+	{
+		LuaV3 v = ToV3( L, 2 );
+		PushV3( L, v.x, v.y, v.z );
+	}
+	else PushV3( L, luaL_optnumber( L, 2, 0 ), luaL_optnumber( L, 3, 0 ), luaL_optnumber( L, 4, 0 ) );
+	return 1;
+}
+
+lua_Number* V3Field( LuaV3* v, lua_State* L, int index )
+{
+	size_t len;
+	if ( lua_type( L, index ) != LUA_TSTRING ) return 0;
+	const char* key = lua_tolstring( L, index, &len );
+	if ( len != 1 ) return 0;
+
+	switch ( key[ 0 ] )
+	{
+	case 'x': return &v->x;
+	case 'y': return &v->y;
+	case 'z': return &v->z;
+	}
+
+	return 0;
+}
+
+int V3_Index( lua_State* L )
+{
+	LuaV3* v = CheckV3( L, 1 );
+	lua_Number* field = V3Field( v, L, 2 );
+
+	if ( field ) lua_pushnumber( L, *field );
+	else lua_gettable( L, lua_upvalueindex( 1 ) );
+	return 1;
+}
+
+int V3_NewIndex( lua_State* L )
+{
+	LuaV3* v = CheckV3( L, 1 );
+	lua_Number* field = V3Field( v, L, 2 );
+	if ( !field ) return luaL_error( L, "v3 has no field %s", luaL_tolstring( L, 2, 0 ) );
+	*field = luaL_checknumber( L, 3 );
+	return 0;
+}
+
+int V3_Add( lua_State* L )
+{
+	LuaV3 a = ToV3( L, 1 );
+	LuaV3 b = ToV3( L, 2 );
+	PushV3( L, a.x + b.x, a.y + b.y, a.z + b.z );
+	return 1;
+}
+
+int V3_Sub( lua_State* L )
+{
+	LuaV3 a = ToV3( L, 1 );
+	LuaV3 b = ToV3( L, 2 );
+	PushV3( L, a.x - b.x, a.y - b.y, a.z - b.z );
+	return 1;
+}
+
+// v3 * number and number * v3 scale, v3 * v3 is the dot product
+int V3_Mul( lua_State* L )
+{
+	if ( lua_type( L, 1 ) == LUA_TNUMBER )
+	{
+		lua_Number s = lua_tonumber( L, 1 );
+		LuaV3 b = ToV3( L, 2 );
+		PushV3( L, s * b.x, s * b.y, s * b.z );
+	}
+
+	else if ( lua_type( L, 2 ) == LUA_TNUMBER )
+	{
+		lua_Number s = lua_tonumber( L, 2 );
+		LuaV3 a = ToV3( L, 1 );
+		PushV3( L, s * a.x, s * a.y, s * a.z );
+	}
+
+	else
+	{
+		LuaV3 a = ToV3( L, 1 );
+		LuaV3 b = ToV3( L, 2 );
+		lua_pushnumber( L, a.x * b.x + a.y * b.y + a.z * b.z );
+	}
+
+	return 1;
+}
+
+int V3_Div( lua_State* L )
+{
+	LuaV3 a = ToV3( L, 1 );
+	lua_Number s = luaL_checknumber( L, 2 );
+	PushV3( L, a.x / s, a.y / s, a.z / s );
+	return 1;
+}
+
+int V3_Unm( lua_State* L )
+{
+	LuaV3* a = CheckV3( L, 1 );
+	PushV3( L, -a->x, -a->y, -a->z );
+	return 1;
+}
+
+int V3_ToString( lua_State* L )
+{
+	LuaV3* a = CheckV3( L, 1 );
+	lua_pushfstring( L, "v3(%f, %f, %f)", a->x, a->y, a->z );
+	return 1;
+}
+
+lua_Number V3Length( LuaV3 a )
+{
+	return sqrt( a.x * a.x + a.y * a.y + a.z * a.z );
+}
+
+// also registered as the global length( a )
+int V3_Length( lua_State* L )
+{
+	lua_pushnumber( L, V3Length( ToV3( L, 1 ) ) );
+	return 1;
+}
+
+int V3_Dot( lua_State* L )
+{
+	LuaV3 a = ToV3( L, 1 );
+	LuaV3 b = ToV3( L, 2 );
+	lua_pushnumber( L, a.x * b.x + a.y * b.y + a.z * b.z );
+	return 1;
+}
+
+int V3_Distance( lua_State* L )
+{
+	LuaV3 a = ToV3( L, 1 );
+	LuaV3 b = ToV3( L, 2 );
+	LuaV3 d;
+	d.x = a.x - b.x;
+	d.y = a.y - b.y;
+	d.z = a.z - b.z;
+	lua_pushnumber( L, V3Length( d ) );
+	return 1;
+}
+
+int V3_Normalized( lua_State* L )
+{
+	LuaV3 a = ToV3( L, 1 );
+	lua_Number magnitude = V3Length( a );
+	PushV3( L, a.x / magnitude, a.y / magnitude, a.z / magnitude );
+	return 1;
+}
+
+int V3_Copy( lua_State* L )
+{
+	LuaV3* a = CheckV3( L, 1 );
+	PushV3( L, a->x, a->y, a->z );
+	return 1;
+}
+
+// in-place variants, each returns self so calls can be chained
+
+int V3_Normalize( lua_State* L )
+{
+	LuaV3* a = CheckV3( L, 1 );
+	lua_Number magnitude = V3Length( *a );
+	a->x /= magnitude;
+	a->y /= magnitude;
+	a->z /= magnitude;
+	lua_settop( L, 1 );
+	return 1;
+}
+
+// v:set( x, y, z ) or v:set( other )
+int V3_Set( lua_State* L )
+{
+	LuaV3* a = CheckV3( L, 1 );
+	int type = lua_type( L, 2 );
+	if ( type == LUA_TTABLE || type == LUA_TUSERDATA ) *a = ToV3( L, 2 );
+	else
+	{
+		a->x = luaL_checknumber( L, 2 );
+		a->y = luaL_checknumber( L, 3 );
+		a->z = luaL_checknumber( L, 4 );
+	}
+	lua_settop( L, 1 );
+	return 1;
+}
+
+int V3_AddInPlace( lua_State* L )
+{
+	LuaV3* a = CheckV3( L, 1 );
+	LuaV3 b = ToV3( L, 2 );
+	a->x += b.x;
+	a->y += b.y;
+	a->z += b.z;
+	lua_settop( L, 1 );
+	return 1;
+}
+
+int V3_SubInPlace( lua_State* L )
+{
+	LuaV3* a = CheckV3( L, 1 );
+	LuaV3 b = ToV3( L, 2 );
+	a->x -= b.x;
+	a->y -= b.y;
+	a->z -= b.z;
+	lua_settop( L, 1 );
+	return 1;
+}
+
+int V3_Scale( lua_State* L )
+{
+	LuaV3* a = CheckV3( L, 1 );
+	lua_Number s = luaL_checknumber( L, 2 );
+	a->x *= s;
+	a->y *= s;
+	a->z *= s;
+	lua_settop( L, 1 );
+	return 1;
+}
+
+// v:addScaled( b, s ) is v = v + b * s
+int V3_AddScaled( lua_State* L )
+{
+	LuaV3* a = CheckV3( L, 1 );
+	LuaV3 b = ToV3( L, 2 );
+	lua_Number s = luaL_checknumber( L, 3 );
+	a->x += b.x * s;
+	a->y += b.y * s;
+	a->z += b.z * s;
+	lua_settop( L, 1 );
+	return 1;
+}
+
+void RegisterV3( lua_State* L )
+{
+	static const luaL_Reg methods[] = {
+		{ "length", V3_Length },
+		{ "dot", V3_Dot },
+		{ "distance", V3_Distance },
+		{ "normalized", V3_Normalized },
+		{ "copy", V3_Copy },
+		{ "normalize", V3_Normalize },
+		{ "set", V3_Set },
+		{ "add", V3_AddInPlace },
+		{ "sub", V3_SubInPlace },
+		{ "scale", V3_Scale },
+		{ "addScaled", V3_AddScaled },
+		{ NULL, NULL }
+	};
+
+	static const luaL_Reg metamethods[] = {
+		{ "__newindex", V3_NewIndex },
+		{ "__add", V3_Add },
+		{ "__sub", V3_Sub },
+		{ "__mul", V3_Mul },
+		{ "__div", V3_Div },
+		{ "__unm", V3_Unm },
+		{ "__tostring", V3_ToString },
+		{ NULL, NULL }
+	};
+
+	// the global v3 is the method table, callable to make new v3s
+	luaL_newlib( L, methods );
+	lua_newtable( L );
+	lua_pushcfunction( L, V3_New );
+	lua_setfield( L, -2, "__call" );
+	lua_setmetatable( L, -2 );
+
+	luaL_newmetatable( L, V3_MT );
+	luaL_setfuncs( L, metamethods, 0 );
+	lua_pushvalue( L, -2 );
+	lua_pushcclosure( L, V3_Index, 1 );
+	lua_setfield( L, -2, "__index" );
+	lua_pop( L, 1 );
+
+	lua_setglobal( L, "v3" );
+	lua_pushcfunction( L, V3_Length );
+	lua_setglobal( L, "length" );
+}
+
+const InstanceData identity_instance = { { 0, 0, 0 }, { 1, 1, 1 }, { 0, 0, 0, 1 } };
+
+// Sort key for tgPushDrawCall. Every call here is opaque, so calls group by
+// shader and then draw front to back by their nearest depth. The state field
+// only orders calls at equal depth and lets DrawKeyName find the call's name;
+// renders and meshes are numbered apart in it. It holds 16 bits, so handles past
+// STATE_ID_MASK wrap around and share ids, which costs names but never order.
+#define STATE_ID_MASK 0xFFFF
+#define RENDER_STATE_ID( handle ) (((uint32_t)(handle) * 2) & STATE_ID_MASK)
+#define MESH_STATE_ID( handle ) (((uint32_t)(handle) * 2 + 1) & STATE_ID_MASK)
+
+uint64_t DrawKey( tgRenderable* r, uint32_t id, float depth )
+{
+	TG_ASSERT( id <= STATE_ID_MASK );
+	tgRenderState state;
+	state.key = 0;
+	state.shader = r->program->program;
+	state.depth = tgDepthKey( depth, NEAR_PLANE, FAR_PLANE );
+	state.state = id;
+	return state.key;
+}
+
+float NearestInstanceDepth( Mesh* mesh )
+{
+	float nearest = FLT_MAX;
+	for ( int i = 0; i < mesh->instance_count; ++i )
+	{
+		float depth = ViewDepth( mesh->instances[ i ].offset );
+		if ( depth < nearest ) nearest = depth;
+	}
+	return nearest;
+}
+
+int Flush( lua_State *L )
+{
+	LUA_ERROR_IF( L, lua_gettop( L ) != 1, "SetRender expects 1 parameter, a string" );
+	const char* name = luaL_checkstring( L, -1 );
+	lua_settop( L, 0 );
+	int call_index = FindRender( name );
+	DrawCall* dc = meshes.calls + call_index;
+	tgDrawCall call;
+	call.texture_count = 0;
+	call.r = &dc->r;
+	call.verts = dc->verts;
+	call.vert_count = dc->count;
+	call.instances = (void*)&identity_instance;
+	call.instance_count = 1;
+	return 0;
+}
+
+int AddRender( tgRenderable* render, const char* name )
+{
+	if ( meshes.render_count == meshes.render_capacity )
+	{
+		meshes.render_capacity *= 2;
+		meshes.render_names = (char**)realloc( meshes.render_names, sizeof( char* ) * meshes.render_capacity );
+		meshes.calls = (DrawCall*)realloc( meshes.calls, sizeof( DrawCall ) * meshes.render_capacity );
+	}
+
+	int handle = meshes.render_count++;
+	meshes.render_names[ handle ] = strdup( name );
+	NameTableInsert( &meshes.render_table, meshes.render_names[ handle ], handle );
+	DrawCall call;
+	memset( &call, 0, sizeof( call ) );
+	call.r = *render;
 	call.capacity = 1024;
-	call.verts = (Vertex*)malloc( sizeof( Vertex ) * 1024 );
-	meshes.calls[ meshes.render_count++ ] = call;
+	call.verts = (StreamVertex*)malloc( sizeof( StreamVertex ) * 1024 );
+	meshes.calls[ handle ] = call;
+	return handle;
 }
 
 #ifdef _WIN32
@@ -871,23 +3157,60 @@ void AddRender( tgRenderable* render, const char* name )
 	} \
 	while ( 0 )
 
-void SetUpRenderable(uint32_t primitiveType, const char* name, const char* vsPath, const char* psPath)
+// Inserts defines, e.g. "#define SMOOTH_NORMALS\n", after the #version line of
+// the vertex shader, so one file can build variants.
+char* InsertShaderDefines( char* source, const char* defines )
 {
-	tgVertexData vd;
-	tgMakeVertexData( &vd, 1024 * 1024, primitiveType, sizeof( Vertex ), GL_DYNAMIC_DRAW );
-	tgAddAttribute( &vd, "a_pos", 3, TG_FLOAT, TG_OFFSET_OF( Vertex, position ) );
-	tgAddAttribute( &vd, "a_col", 3, TG_FLOAT, TG_OFFSET_OF( Vertex, color ) );
-	tgAddAttribute( &vd, "a_normal", 3, TG_FLOAT, TG_OFFSET_OF( Vertex, normal ) );
+	char* body = strchr( source, '\n' );
+	body = body ? body + 1 : source + strlen( source );
+	size_t head = body - source;
+	size_t length = strlen( defines );
+	char* out = (char*)malloc( strlen( source ) + length + 1 );
+	memcpy( out, source, head );
+	memcpy( out + head, defines, length );
+	strcpy( out + head + length, body );
+	free( source );
+	return out;
+}
 
-	tgRenderable r;
-	tgMakeRenderable( &r, &vd );
-	char* vs = (char*)ReadFileToMemory( vsPath, 0 );
-	char* ps = (char*)ReadFileToMemory( psPath, 0 );
+void LoadShaderFilesDefines( tgShader* s, const char* vs_path, const char* ps_path, const char* defines )
+{
+	char* vs = (char*)ReadFileToMemory( vs_path, 0 );
+	char* ps = (char*)ReadFileToMemory( ps_path, 0 );
 	TG_ASSERT( vs );
 	TG_ASSERT( ps );
-	tgLoadShader( &simple, vs, ps );
+	if ( defines ) vs = InsertShaderDefines( vs, defines );
+	tgLoadShader( s, vs, ps );
 	free( vs );
 	free( ps );
+}
+
+void LoadShaderFiles( tgShader* s, const char* vs_path, const char* ps_path )
+{
+	LoadShaderFilesDefines( s, vs_path, ps_path, 0 );
+}
+
+// Streamed StreamVertex verts, already in world space, drawn as a single
+// identity instance.
+void MakeStreamRenderable( tgRenderable* r, uint32_t primitive, uint32_t vert_capacity )
+{
+	tgVertexData vd;
+	tgMakeVertexData( &vd, vert_capacity, primitive, sizeof( StreamVertex ), GL_DYNAMIC_DRAW );
+	tgAddAttribute( &vd, "a_pos", 3, TG_FLOAT, TG_OFFSET_OF( StreamVertex, position ) );
+	tgAddAttribute( &vd, "a_col", 4, TG_UNORM8, TG_OFFSET_OF( StreamVertex, color ) );
+	tgAddAttribute( &vd, "a_normal", 4, TG_SNORM10, TG_OFFSET_OF( StreamVertex, normal ) );
+
+	tgVertexData instance_vd;
+	MakeInstanceVertexData( &instance_vd, 1024 );
+	tgMakeInstancedRenderable( r, &vd, &instance_vd );
+}
+
+void SetUpRenderable(uint32_t primitiveType, const char* name, const char* vsPath, const char* psPath)
+{
+	tgRenderable r;
+	MakeStreamRenderable( &r, primitiveType, 1024 * 1024 );
+	LoadShaderFiles( &simple, vsPath, psPath );
+	tgBindUniformBlock( &simple, "Frame", &frame_block );
 	tgSetShader( &r, &simple );
 	AddRender( &r, name );
 }
@@ -1052,72 +3375,213 @@ void DoPlayerCollision( )
 	}
 }
 
-#define WAVE_W 30
-#define WAVE_H 30
+// Grid size in cells, picked at startup with --wave=N or --wave=WxH. The grid
+// always covers the same area, finer grids just space the particles closer.
+#define WAVE_DEFAULT_SIZE 30
+#define WAVE_MIN_SIZE 4
+#define WAVE_MAX_SIZE 1024
+int WAVE_W = WAVE_DEFAULT_SIZE;
+int WAVE_H = WAVE_DEFAULT_SIZE;
 #define WAVE_COLOR V3( 0.6f, 0.75f, 0.95f )
 
+// WAVE_PROPOGATION is the coupling per relaxation pass at WAVE_TUNED_CELL, the
+// cell size of the default grid. Finer grids couple harder, see SetWaveCoupling.
 #define WAVE_PROPOGATION 0.001f
+#define WAVE_TUNED_CELL 30.0f
 #define WAVE_STIFFNESS 0.0001f
 #define WAVE_INITIAL_H 0.0f
 
 #define WAVE_OFFSET_X (0.0f)
 #define WAVE_OFFSET_Y (-150.0f)
 #define WAVE_OFFSET_Z (0.0f)
-#define WAVE_SCALE_X  (30.0f)
+#define WAVE_EXTENT_X (900.0f)
+#define WAVE_EXTENT_Z (900.0f)
+#define WAVE_SCALE_X  (WAVE_EXTENT_X / WAVE_W)
 #define WAVE_SCALE_Y  (30.0f)
-#define WAVE_SCALE_Z  (30.0f)
+#define WAVE_SCALE_Z  (WAVE_EXTENT_Z / WAVE_H)
 
-#define WAVE_HALF_X (WAVE_W * WAVE_SCALE_X / 2)
-#define WAVE_HALF_Z (WAVE_H * WAVE_SCALE_Z / 2)
+#define WAVE_HALF_X (WAVE_EXTENT_X / 2)
+#define WAVE_HALF_Z (WAVE_EXTENT_Z / 2)
 
 float WAVE_HEIGHT_VARIANCE = 0.0f;
 
-typedef struct
-{
-	int a;
-	int b;
-} WaveEdge;
+typedef struct
+{
+	int a;
+	int b;
+	int c;
+} WaveFace;
+
+#define WAVE_PARTICLE_COUNT ((WAVE_W + 1) * (WAVE_H + 1))
+#define WAVE_FACE_COUNT (WAVE_W * WAVE_H * 2)
+#define WAVE_RELAX_PASSES 10
+
+// Jacobi passes keep every particle between its neighbours, and so stay stable,
+// while the couplings of its four links sum to at most 1. This leaves a margin.
+#define WAVE_MAX_COUPLING 0.9f
+
+// set by SetWaveCoupling from the grid size
+float wave_k_x;
+float wave_k_z;
+int wave_relax_passes;
+
+// The wave state is kept as separate arrays so the solver loops stream through
+// plain floats. wave_scratch holds the odd relaxation passes.
+float* wave_h;
+float* wave_h_old;
+float* wave_v;
+float* wave_scratch;
+WaveFace* wave_faces;
+
+// The CPU wave streams one vert per particle each frame, drawn through
+// wave_faces as a persistent index buffer. Both sides show with culling off,
+// see wave.ps.
+tgShader wave_shader;
+int wave_render;
+
+// Above this many particles the solver spreads its passes over the expand
+// pool, in bands of WAVE_BAND_ROWS rows.
+#define WAVE_PARALLEL_MIN_PARTICLES (64 * 64)
+#define WAVE_BAND_ROWS 16
+#define WAVE_BAND_COUNT ((WAVE_H + WAVE_BAND_ROWS) / WAVE_BAND_ROWS)
+
+// Particle i is linked to i + 1 for i < WAVE_LINKS_H, and to i + WAVE_W for
+// i < WAVE_LINKS_V. Rows are WAVE_W + 1 long, so the second link is not quite
+// the particle below, but that is how the wave has always propagated. When
+// WAVE_W > WAVE_H + 1 the last of those links would point past the grid, so
+// WAVE_LINKS_V is capped to the links that stay inside it. Since
+// the links sit at fixed offsets in the flat arrays, a relaxation pass is a
+// stencil: every particle moves toward each linked neighbour by wave_k_x or
+// wave_k_z times their height difference. The passes are Jacobi style,
+// reading only the previous pass, so particles can be solved in any order and
+// in SIMD lanes.
+#define WAVE_LINKS_H ((WAVE_W + 1) * WAVE_H)
+#define WAVE_LINKS_V (WAVE_W <= WAVE_H + 1 ? WAVE_W * (WAVE_H + 1) : WAVE_PARTICLE_COUNT - WAVE_W)
+
+// Particles in [WAVE_INTERIOR_BEGIN, WAVE_INTERIOR_END) have all four links.
+#define WAVE_INTERIOR_BEGIN WAVE_W
+#define WAVE_INTERIOR_END (WAVE_LINKS_H < WAVE_LINKS_V ? WAVE_LINKS_H : WAVE_LINKS_V)
+
+typedef void (*WaveRelaxFunc)( const float* h, float* out, int begin, int end );
+
+float WaveRelaxParticle( const float* h, int i )
+{
+	float c = h[ i ];
+	float row = 0.0f;
+	float col = 0.0f;
+	if ( i < WAVE_LINKS_H ) row += h[ i + 1 ] - c;
+	if ( i >= 1 && i - 1 < WAVE_LINKS_H ) row += h[ i - 1 ] - c;
+	if ( i < WAVE_LINKS_V ) col += h[ i + WAVE_W ] - c;
+	if ( i >= WAVE_W && i - WAVE_W < WAVE_LINKS_V ) col += h[ i - WAVE_W ] - c;
+	return c + row * wave_k_x + col * wave_k_z;
+}
+
+// Interior only, no link checks.
+void WaveRelax_Scalar( const float* h, float* out, int begin, int end )
+{
+	int w = WAVE_W;
+	float kx = wave_k_x;
+	float kz = wave_k_z;
+	for ( int i = begin; i < end; ++i )
+	{
+		float c = h[ i ];
+		float row = (h[ i - 1 ] + h[ i + 1 ]) - 2.0f * c;
+		float col = (h[ i - w ] + h[ i + w ]) - 2.0f * c;
+		out[ i ] = c + row * kx + col * kz;
+	}
+}
+
+#if POOK_X86
+
+void WaveRelax_SSE( const float* h, float* out, int begin, int end )
+{
+	__m128 two = _mm_set1_ps( 2.0f );
+	__m128 kx = _mm_set1_ps( wave_k_x );
+	__m128 kz = _mm_set1_ps( wave_k_z );
+	int w = WAVE_W;
+	int i = begin;
+	for ( ; i + 4 <= end; i += 4 )
+	{
+		__m128 c = _mm_loadu_ps( h + i );
+		__m128 c2 = _mm_mul_ps( two, c );
+		__m128 row = _mm_sub_ps( _mm_add_ps( _mm_loadu_ps( h + i - 1 ), _mm_loadu_ps( h + i + 1 ) ), c2 );
+		__m128 col = _mm_sub_ps( _mm_add_ps( _mm_loadu_ps( h + i - w ), _mm_loadu_ps( h + i + w ) ), c2 );
+		__m128 sum = _mm_add_ps( _mm_mul_ps( row, kx ), _mm_mul_ps( col, kz ) );
+		_mm_storeu_ps( out + i, _mm_add_ps( c, sum ) );
+	}
+	WaveRelax_Scalar( h, out, i, end );
+}
+
+POOK_TARGET_AVX void WaveRelax_AVX( const float* h, float* out, int begin, int end )
+{
+	__m256 two = _mm256_set1_ps( 2.0f );
+	__m256 kx = _mm256_set1_ps( wave_k_x );
+	__m256 kz = _mm256_set1_ps( wave_k_z );
+	int w = WAVE_W;
+	int i = begin;
+	for ( ; i + 8 <= end; i += 8 )
+	{
+		__m256 c = _mm256_loadu_ps( h + i );
+		__m256 c2 = _mm256_mul_ps( two, c );
+		__m256 row = _mm256_sub_ps( _mm256_add_ps( _mm256_loadu_ps( h + i - 1 ), _mm256_loadu_ps( h + i + 1 ) ), c2 );
+		__m256 col = _mm256_sub_ps( _mm256_add_ps( _mm256_loadu_ps( h + i - w ), _mm256_loadu_ps( h + i + w ) ), c2 );
+		__m256 sum = _mm256_add_ps( _mm256_mul_ps( row, kx ), _mm256_mul_ps( col, kz ) );
+		_mm256_storeu_ps( out + i, _mm256_add_ps( c, sum ) );
+	}
+	WaveRelax_Scalar( h, out, i, end );
+}
+
+#endif
+
+WaveRelaxFunc WaveRelax = WaveRelax_Scalar;
 
-typedef struct
+// Parses "N" or "WxH", clamped to the supported sizes.
+void SetWaveSize( const char* size )
 {
-	float h;
-	float h_old;
-	float v;
-} WaveParticle;
+	int w, h;
+	int count = sscanf( size, "%dx%d", &w, &h );
+	if ( count < 1 ) return;
+	if ( count == 1 ) h = w;
+	WAVE_W = w < WAVE_MIN_SIZE ? WAVE_MIN_SIZE : w > WAVE_MAX_SIZE ? WAVE_MAX_SIZE : w;
+	WAVE_H = h < WAVE_MIN_SIZE ? WAVE_MIN_SIZE : h > WAVE_MAX_SIZE ? WAVE_MAX_SIZE : h;
+}
 
-typedef struct
+// Heights spread by diffusion, which covers world distance in proportion to
+// coupling times cell size squared, per pass. Scaling the coupling by the
+// inverse square of the cell size keeps the wave spreading over the same world
+// distance per frame at any grid size. Once a pass would need more coupling than
+// WAVE_MAX_COUPLING allows, the frame takes more, weaker passes instead.
+void SetWaveCoupling( )
 {
-	int a;
-	int b;
-	int c;
-} WaveFace;
-
-#define WAVE_PARTICLE_COUNT ((WAVE_W + 1) * (WAVE_H + 1))
-#define WAVE_FACE_COUNT (WAVE_W * WAVE_H * 2 * 2)
-int edge_count;
-WaveEdge wave_edges[ WAVE_W * WAVE_H * 4 ];
-WaveParticle wave_particles[ WAVE_PARTICLE_COUNT ];
-WaveFace wave_faces[ WAVE_FACE_COUNT ];
+	float fx = WAVE_TUNED_CELL / WAVE_SCALE_X;
+	float fz = WAVE_TUNED_CELL / WAVE_SCALE_Z;
+	float kx = WAVE_PROPOGATION * fx * fx * WAVE_RELAX_PASSES;
+	float kz = WAVE_PROPOGATION * fz * fz * WAVE_RELAX_PASSES;
+
+	// an even count, see SolveWave
+	int passes = (int)ceilf( (kx + kz) * 2.0f / WAVE_MAX_COUPLING );
+	if ( passes < WAVE_RELAX_PASSES ) passes = WAVE_RELAX_PASSES;
+	passes += passes & 1;
+
+	wave_relax_passes = passes;
+	wave_k_x = kx / passes;
+	wave_k_z = kz / passes;
+}
 
 void InitWave( )
 {
-    int hc = (WAVE_W + 1) * WAVE_H;
-    int vc = WAVE_W * (WAVE_H + 1);
-	edge_count = hc + vc;
+	SetWaveCoupling( );
 
-	for ( int i = 0; i < hc; ++i )
-	{
-		WaveEdge* e = wave_edges + i;
-		e->a = i;
-		e->b = i + 1;
-	}
+#if POOK_X86
+	if ( CpuHasAVX( ) ) WaveRelax = WaveRelax_AVX;
+	else if ( CpuHasSSE2( ) ) WaveRelax = WaveRelax_SSE;
+#endif
 
-	for ( int i = 0; i < vc; ++i )
-	{
-		WaveEdge* e = wave_edges + (i + hc);
-		e->a = i;
-		e->b = i + WAVE_W;
-	}
+	wave_h = (float*)calloc( WAVE_PARTICLE_COUNT * 4, sizeof( float ) );
+	wave_h_old = wave_h + WAVE_PARTICLE_COUNT;
+	wave_v = wave_h_old + WAVE_PARTICLE_COUNT;
+	wave_scratch = wave_v + WAVE_PARTICLE_COUNT;
+	wave_faces = (WaveFace*)malloc( sizeof( WaveFace ) * WAVE_FACE_COUNT );
 
 	int k = 0;
 	for ( int i = 0; i < WAVE_H; ++i )
@@ -1138,99 +3602,328 @@ void InitWave( )
 			f->b = (i + 1) * (WAVE_W + 1) + j;
 			f->c = (i + 1) * (WAVE_W + 1) + j + 1;
 			//printf( "%d %d %d\n", f->a, f->b, f->c );
-
-			// flip to render underside of wave
-			TG_ASSERT( k < WAVE_FACE_COUNT );
-			f = wave_faces + k++;
-			f->a = i * (WAVE_W + 1) + j + 1;
-			f->c = i * (WAVE_W + 1) + j;
-			f->b = (i + 1) * (WAVE_W + 1) + j;
-			//printf( "%d %d %d\n", f->a, f->b, f->c );
-
-			TG_ASSERT( k < WAVE_FACE_COUNT );
-			f = wave_faces + k++;
-			f->a = i * (WAVE_W + 1) + j + 1;
-			f->c = (i + 1) * (WAVE_W + 1) + j;
-			f->b = (i + 1) * (WAVE_W + 1) + j + 1;
-			//printf( "%d %d %d\n", f->a, f->b, f->c );
 		}
 	}
 	TG_ASSERT( k == WAVE_FACE_COUNT );
 }
 
-void SolveEdges( )
+void FreeWave( )
+{
+	free( wave_h );
+	free( wave_faces );
+}
+
+// Relaxes particles [begin, end) of h into out.
+void SolveEdges( const float* h, float* out, int begin, int end )
+{
+	int interior_begin = begin > WAVE_INTERIOR_BEGIN ? begin : WAVE_INTERIOR_BEGIN;
+	int interior_end = end < WAVE_INTERIOR_END ? end : WAVE_INTERIOR_END;
+	int i = begin;
+	for ( ; i < end && i < interior_begin; ++i )
+		out[ i ] = WaveRelaxParticle( h, i );
+	if ( interior_begin < interior_end )
+	{
+		WaveRelax( h, out, interior_begin, interior_end );
+		i = interior_end;
+	}
+	for ( ; i < end; ++i )
+		out[ i ] = WaveRelaxParticle( h, i );
+}
+
+// Every particle reads only its own state or the previous pass, so the bands
+// of a pass can run in any order on any thread and give the same result.
+typedef void (*WaveBandFunc)( int band );
+
+const float* wave_relax_src;
+float* wave_relax_dst;
+float wave_dt;
+
+void WaveBandRange( int band, int* begin, int* end )
+{
+	int band_size = WAVE_BAND_ROWS * (WAVE_W + 1);
+	*begin = band * band_size;
+	*end = *begin + band_size < WAVE_PARTICLE_COUNT ? *begin + band_size : WAVE_PARTICLE_COUNT;
+}
+
+void IntegrateWaveBand( int band )
+{
+	int begin, end;
+	WaveBandRange( band, &begin, &end );
+	for( int i = begin; i < end; ++i )
+		wave_h[ i ] += wave_v[ i ] * wave_dt;
+}
+
+void RelaxWaveBand( int band )
+{
+	int begin, end;
+	WaveBandRange( band, &begin, &end );
+	SolveEdges( wave_relax_src, wave_relax_dst, begin, end );
+}
+
+void SettleWaveBand( int band )
 {
-    for ( int i = 0; i < edge_count; ++i )
-    {
-		WaveEdge* e = wave_edges + i;
-		WaveParticle* a = wave_particles + e->a;
-		WaveParticle* b = wave_particles + e->b;
+	int begin, end;
+	WaveBandRange( band, &begin, &end );
+
+	// solve depths
+	for ( int i = begin; i < end; ++i )
+		wave_h[ i ] += (WAVE_INITIAL_H - wave_h[ i ]) * WAVE_STIFFNESS;
 
-		float d = b->h - a->h;
-		d *= WAVE_PROPOGATION;
+	// vel fixup
+	if ( wave_dt == 0.0f ) return;
+	float inv_dt = 1.0f / wave_dt;
+	for ( int i = begin; i < end; ++i )
+	{
+		wave_v[ i ] = inv_dt * (wave_h[ i ] - wave_h_old[ i ]);
+		wave_h_old[ i ] = wave_h[ i ];
+	}
+}
 
-		a->h += d;
-		b->h -= d;
-    }
+void RunWaveBands( WaveBandFunc func )
+{
+	if ( WAVE_PARTICLE_COUNT >= WAVE_PARALLEL_MIN_PARTICLES )
+		RunPoolTasks( func, WAVE_BAND_COUNT );
+	else for ( int i = 0; i < WAVE_BAND_COUNT; ++i )
+		func( i );
 }
 
 void SolveWave( float dt )
 {
-	// integration
-	for( int i = 0; i < WAVE_PARTICLE_COUNT; ++i )
+	wave_dt = dt;
+	RunWaveBands( IntegrateWaveBand );
+
+	// passes go out to the scratch array and back, ending in wave_h
+	TG_ASSERT( wave_relax_passes % 2 == 0 );
+	for ( int i = 0; i < wave_relax_passes; ++i )
 	{
-		WaveParticle* p = wave_particles + i;
-		p->h += p->v * dt;
+		wave_relax_src = i & 1 ? wave_scratch : wave_h;
+		wave_relax_dst = i & 1 ? wave_h : wave_scratch;
+		RunWaveBands( RelaxWaveBand );
 	}
 
-	for ( int i = 0; i < 10; ++i )
-		SolveEdges( );
+	RunWaveBands( SettleWaveBand );
+}
 
-	// solve depths
+// Optional GPU wave, enabled with --gpu-wave. The state lives in two RGBA32F
+// targets, one texel per particle holding height, old height and velocity, and
+// SolveWave's passes run as fragment shaders ping-ponging between them. A
+// static grid drawn with wave.vs is displaced by the heights, so the CPU
+// neither solves nor streams the wave. The heights come back to wave_h a frame
+// or so late, for collision.
+typedef struct
+{
+	int enabled;
+	void* ctx;
+	int current;
+	tgRenderTarget state[ 2 ];
+	tgReadback readback;
+	tgShader sim;
+	tgShader impulse;
+	tgShader draw;
+	int render;
+} GpuWave;
+
+GpuWave gpu_wave;
+
+// uniforms shared by the impulse and draw shaders for placing particles
+void SendWaveGrid( tgShader* s )
+{
+	float grid[ 4 ] = { (float)WAVE_W, (float)WAVE_H, (float)(WAVE_W / 2), (float)(WAVE_H / 2) };
+	float scale[ 3 ] = { WAVE_SCALE_X, WAVE_SCALE_Y, WAVE_SCALE_Z };
+	tgSendF32( s, "u_grid", 1, grid, 4 );
+	tgSendF32( s, "u_scale", 1, scale, 3 );
+}
+
+void SendWaveOffset( tgShader* s )
+{
+	float offset[ 3 ] = { WAVE_OFFSET_X, WAVE_OFFSET_Y + WAVE_HEIGHT_VARIANCE, WAVE_OFFSET_Z };
+	tgSendF32( s, "u_offset", 1, offset, 3 );
+}
+
+// After InitWave, starts from the CPU wave's zeroed state.
+void InitGpuWave( void* ctx )
+{
+	gpu_wave.ctx = ctx;
+	for ( int i = 0; i < 2; ++i )
+		tgMakeRenderTarget( gpu_wave.state + i, WAVE_W + 1, WAVE_H + 1, GL_RGBA32F, NULL );
+	tgMakeReadback( &gpu_wave.readback, gpu_wave.state );
+
+	LoadShaderFiles( &gpu_wave.sim, "./assets/shaders/wave_sim.vs", "./assets/shaders/wave_sim.ps" );
+	float grid[ 2 ] = { (float)WAVE_W, (float)WAVE_H };
+	float solver[ 4 ] = { wave_k_x, wave_k_z, WAVE_STIFFNESS, WAVE_INITIAL_H };
+	tgSendF32( &gpu_wave.sim, "u_grid", 1, grid, 2 );
+	tgSendF32( &gpu_wave.sim, "u_solver", 1, solver, 4 );
+
+	LoadShaderFiles( &gpu_wave.impulse, "./assets/shaders/wave_sim.vs", "./assets/shaders/wave_impulse.ps" );
+	SendWaveGrid( &gpu_wave.impulse );
+
+	LoadShaderFiles( &gpu_wave.draw, "./assets/shaders/wave.vs", "./assets/shaders/wave.ps" );
+	tgBindUniformBlock( &gpu_wave.draw, "Frame", &frame_block );
+	SendWaveGrid( &gpu_wave.draw );
+	float ramp[ 2 ] = { initialWaveY - WAVE_OFFSET_Y, WAVE_OFFSET_Y * 2.0f };
+	tgSendF32( &gpu_wave.draw, "u_colorRamp", 1, ramp, 2 );
+
+	// one vert per particle, indexed by the same faces as the CPU wave
+	float* cells = (float*)malloc( sizeof( float ) * 2 * WAVE_PARTICLE_COUNT );
 	for ( int i = 0; i < WAVE_PARTICLE_COUNT; ++i )
 	{
-		WaveParticle* p = wave_particles + i;
-		float x = WAVE_INITIAL_H - p->h;
-		p->h += x * WAVE_STIFFNESS;
+		cells[ i * 2 ] = (float)(i % (WAVE_W + 1));
+		cells[ i * 2 + 1 ] = (float)(i / (WAVE_W + 1));
 	}
 
-	// vel fixup
-	if ( dt == 0.0f ) return;
-	float inv_dt = 1.0f / dt;
-	for ( int i = 0; i < WAVE_PARTICLE_COUNT; ++i )
+	tgVertexData vd;
+	tgMakeVertexData( &vd, WAVE_PARTICLE_COUNT, GL_TRIANGLES, sizeof( float ) * 2, GL_STATIC_DRAW );
+	tgAddAttribute( &vd, "a_cell", 2, TG_FLOAT, 0 );
+	tgRenderable r;
+	tgMakeRenderable( &r, &vd );
+	tgSetShader( &r, &gpu_wave.draw );
+	tgUpload( &r, cells, WAVE_PARTICLE_COUNT );
+	tgUploadIndices( &r, (uint32_t*)wave_faces, WAVE_FACE_COUNT * 3 );
+	r.double_sided = 1;
+	gpu_wave.render = AddRender( &r, "wave" );
+	free( cells );
+}
+
+void FreeGpuWave( )
+{
+	if ( !gpu_wave.ctx ) return;
+	tgFreeRenderTarget( gpu_wave.state );
+	tgFreeRenderTarget( gpu_wave.state + 1 );
+	tgFreeReadback( &gpu_wave.readback );
+	tgFreeShader( &gpu_wave.sim );
+	tgFreeShader( &gpu_wave.impulse );
+	tgFreeShader( &gpu_wave.draw );
+	tgFreeRenderable( &meshes.calls[ gpu_wave.render ].r );
+}
+
+void GpuWavePass( tgShader* s )
+{
+	tgRenderTarget* src = gpu_wave.state + gpu_wave.current;
+	gpu_wave.current ^= 1;
+	tgRunPass( gpu_wave.ctx, s, gpu_wave.state + gpu_wave.current, &src->tex_id, 1 );
+}
+
+void SolveGpuWave( float dt )
+{
+	for ( int i = 0; i < wave_relax_passes; ++i )
 	{
-		WaveParticle* p = wave_particles + i;
-		float delta = p->h - p->h_old;
-		p->v = inv_dt * delta;
-		p->h_old = p->h;
+		float integrate = i == 0 ? dt : 0.0f;
+		float settle = i == wave_relax_passes - 1 ? 1.0f : 0.0f;
+		tgSendF32( &gpu_wave.sim, "u_integrate", 1, &integrate, 1 );
+		tgSendF32( &gpu_wave.sim, "u_settle", 1, &settle, 1 );
+		tgSendF32( &gpu_wave.sim, "u_dt", 1, &dt, 1 );
+		GpuWavePass( &gpu_wave.sim );
 	}
+
+	tgReadRedChannel( &gpu_wave.readback, gpu_wave.state + gpu_wave.current, wave_h );
+}
+
+void MakeGpuWave( v3 at, float radius, float force )
+{
+	float impulse[ 4 ] = { at.x, at.y, at.z, radius };
+	tgSendF32( &gpu_wave.impulse, "u_impulse", 1, impulse, 4 );
+	tgSendF32( &gpu_wave.impulse, "u_force", 1, &force, 1 );
+	SendWaveOffset( &gpu_wave.impulse );
+	GpuWavePass( &gpu_wave.impulse );
+}
+
+void DrawGpuWave( )
+{
+	SendWaveOffset( &gpu_wave.draw );
+	tgSendF32( &gpu_wave.draw, "u_player", 1, &player_position.x, 3 );
+
+	DrawCall* dc = meshes.calls + gpu_wave.render;
+	tgDrawCall call;
+	call.r = &dc->r;
+	call.texture_count = 1;
+	call.textures[ 0 ] = gpu_wave.state[ gpu_wave.current ].tex_id;
+	call.verts = 0;
+	call.vert_count = WAVE_PARTICLE_COUNT;
+	call.instances = 0;
+	call.instance_count = 0;
+	call.state.key = DrawKey( &dc->r, RENDER_STATE_ID( gpu_wave.render ), 0 );
+	tgPushDrawCall( gpu_wave.ctx, call );
 }
 
 v3 GetParticlePosition( int i )
 {
-	WaveParticle* p = wave_particles + i;
 	float x = (float)((i % (WAVE_W + 1)) - (WAVE_W / 2));
 	float z = (float)((i / (WAVE_W + 1)) - (WAVE_H / 2));
 	x *= WAVE_SCALE_X;
 	z *= WAVE_SCALE_Z;
 	x += WAVE_OFFSET_X;
 	z += WAVE_OFFSET_Z;
-	return V3( x, p->h * WAVE_SCALE_Y + WAVE_OFFSET_Y + WAVE_HEIGHT_VARIANCE, z );
+	return V3( x, wave_h[ i ] * WAVE_SCALE_Y + WAVE_OFFSET_Y + WAVE_HEIGHT_VARIANCE, z );
 }
 
-void MakeWave( v3 at, float radius, float force )
+// Finds the cells within extent of center along one grid axis, both in
+// cells. Rounds outward, the caller tests the exact distance. Returns 0 when
+// the range misses the grid.
+int WaveCellRange( float center, float extent, int max, int* lo, int* hi )
 {
-	for ( int i = 0; i < WAVE_PARTICLE_COUNT; ++i )
+	float a = floorf( center - extent );
+	float b = ceilf( center + extent );
+	if ( !(b >= 0.0f && a <= (float)max) ) return 0;
+	*lo = a < 0.0f ? 0 : (int)a;
+	*hi = b > (float)max ? max : (int)b;
+	return 1;
+}
+
+// Returns 0 to stop a QueryWave early.
+typedef int (*WaveQueryFunc)( int particle, void* udata );
+
+// Calls func for each particle closer than radius to center, visiting only the
+// rows and columns the sphere overlaps. Returns 0 if func stopped the query.
+int QueryWave( v3 center, float radius, WaveQueryFunc func, void* udata )
+{
+	float r2 = radius * radius;
+	float scale_x = WAVE_SCALE_X;
+	float scale_z = WAVE_SCALE_Z;
+
+	// center in grid units, where cell (x, z) is particle x + z * (WAVE_W + 1)
+	float grid_x = (center.x - WAVE_OFFSET_X) / scale_x + (float)(WAVE_W / 2);
+	float grid_z = (center.z - WAVE_OFFSET_Z) / scale_z + (float)(WAVE_H / 2);
+
+	int z0, z1;
+	if ( !WaveCellRange( grid_z, radius / scale_z, WAVE_H, &z0, &z1 ) ) return 1;
+
+	for ( int z = z0; z <= z1; ++z )
 	{
-		WaveParticle* p = wave_particles + i;
-		v3 pos = GetParticlePosition( i );
-		float l = len( sub( pos, at ) );
-		if ( l < radius )
+		// the row crosses the sphere in a circle, narrowing the columns
+		float dz = (float)(z - WAVE_H / 2) * scale_z + WAVE_OFFSET_Z - center.z;
+		float row_r2 = r2 - dz * dz;
+		if ( row_r2 <= 0.0f ) continue;
+
+		int x0, x1;
+		if ( !WaveCellRange( grid_x, sqrtf( row_r2 ) / scale_x, WAVE_W, &x0, &x1 ) ) continue;
+
+		for ( int x = x0; x <= x1; ++x )
 		{
-			p->h_old = p->h;
-			p->h += force;
+			int i = z * (WAVE_W + 1) + x;
+			v3 d = sub( GetParticlePosition( i ), center );
+			if ( dot( d, d ) < r2 && !func( i, udata ) ) return 0;
 		}
 	}
+
+	return 1;
+}
+
+int PushWaveParticle( int particle, void* udata )
+{
+	wave_h_old[ particle ] = wave_h[ particle ];
+	wave_h[ particle ] += *(float*)udata;
+	return 1;
+}
+
+void MakeWave( v3 at, float radius, float force )
+{
+	if ( gpu_wave.enabled )
+	{
+		MakeGpuWave( at, radius, force );
+		return;
+	}
+
+	QueryWave( at, radius, PushWaveParticle, &force );
 }
 
 v3 CalcWaveColor( v3 p )
@@ -1252,36 +3945,53 @@ v3 CalcWaveColor( v3 p )
 	return c;
 }
 
-void DrawWave( )
+// Normals are smooth, from the height differences across each particle's
+// neighbours, and point up. wave.ps turns them to face away from the viewer.
+void DrawWaveJob( ExpandJob* job, StreamVertex* out )
 {
-	DrawCall* call = meshes.calls + FindRender( "simple" );
-	static float t = 0;
-	t += dt;
-
-	for ( int i = 0; i < WAVE_FACE_COUNT; ++i )
+	int stride = WAVE_W + 1;
+	for ( int i = job->particle0; i < job->particle1; ++i )
 	{
-		WaveFace* f = wave_faces + i;
-		Vertex a;
-		Vertex b;
-		Vertex c;
-		//printf( "%d %d %d\n", f->a, f->b, f->c );
-		a.position = GetParticlePosition( f->a );
-		b.position = GetParticlePosition( f->b );
-		c.position = GetParticlePosition( f->c );
-		//printf( "%f %f %f, %f %f %f, %f %f %f\n", a.position.x, a.position.y, a.position.z, b.position.x, b.position.y, b.position.z, c.position.x, c.position.y, c.position.z );
-		v3 n = norm( cross( sub( b.position, a.position ), sub( b.position, c.position ) ) );
-		a.normal = n;
-		b.normal = n;
-		c.normal = n;
-		a.color = CalcWaveColor( a.position );
-		b.color = CalcWaveColor( b.position );
-		c.color = CalcWaveColor( c.position );
+		int x = i % stride;
+		int z = i / stride;
+		int left = x > 0 ? i - 1 : i;
+		int right = x < WAVE_W ? i + 1 : i;
+		int down = z > 0 ? i - stride : i;
+		int up = z < WAVE_H ? i + stride : i;
+		float dx = (wave_h[ right ] - wave_h[ left ]) * WAVE_SCALE_Y / ((right - left) * WAVE_SCALE_X);
+		float dz = (wave_h[ up ] - wave_h[ down ]) * WAVE_SCALE_Y / ((up - down) / stride * WAVE_SCALE_Z);
+
+		Vertex v;
+		v.position = GetParticlePosition( i );
+		v.normal = norm( V3( -dx, 1.0f, -dz ) );
+		v.color = CalcWaveColor( v.position );
+		*out++ = PackStreamVertex( &v );
+	}
+}
+
+void InitWaveRender( )
+{
+	tgRenderable r;
+	MakeStreamRenderable( &r, GL_TRIANGLES, WAVE_PARTICLE_COUNT );
+	LoadShaderFilesDefines( &wave_shader, "./assets/shaders/simple.vs", "./assets/shaders/wave.ps", "#define SMOOTH_NORMALS\n" );
+	tgBindUniformBlock( &wave_shader, "Frame", &frame_block );
+	tgSetShader( &r, &wave_shader );
+	tgUploadIndices( &r, (uint32_t*)wave_faces, WAVE_FACE_COUNT * 3 );
+	r.double_sided = 1;
+	wave_render = AddRender( &r, "wave" );
+}
+
+#define WAVE_PARTICLES_PER_JOB 1024
 
-		PushTransformedVert( a, call );
-		PushTransformedVert( b, call );
-		PushTransformedVert( c, call );
+void DrawWave( )
+{
+	for ( int i = 0; i < WAVE_PARTICLE_COUNT; i += WAVE_PARTICLES_PER_JOB )
+	{
+		int particle1 = i + WAVE_PARTICLES_PER_JOB < WAVE_PARTICLE_COUNT ? i + WAVE_PARTICLES_PER_JOB : WAVE_PARTICLE_COUNT;
+		ExpandJob* job = PushExpandJob( DrawWaveJob, wave_render, particle1 - i );
+		job->particle0 = i;
+		job->particle1 = particle1;
 	}
-	//printf( "---\n" );
 }
 
 int WAVE_DEBOUNCE = 0;
@@ -1299,21 +4009,16 @@ int ResetGameFromLua( lua_State* L )
 	return 0;
 }
 
-int DetectWaveCollision( )
+int StopAtParticle( int particle, void* udata )
 {
-	int found = 0;
-	v3 a = player_position;
+	(void)particle;
+	(void)udata;
+	return 0;
+}
 
-	for ( int i = 0; i < WAVE_PARTICLE_COUNT; ++i )
-	{
-		v3 b = GetParticlePosition( i );
-		float d = len( sub( b, a ) );
-		if ( d < (player_radius + 10.0f) )
-		{
-			found = 1;
-			break;
-		}
-	}
+int DetectWaveCollision( )
+{
+	int found = !QueryWave( player_position, player_radius + 10.0f, StopAtParticle, 0 );
 
 	if ( found )
 		HitWaveCB( );
@@ -1328,28 +4033,40 @@ tsPlaySoundDef death_def;
 
 int PlayJump(lua_State*L)
 {
+#if POOK_SOUND
 	tsPlaySound(ts_ctx, jump_def);
+#endif
 	return 0;
 }
 
 int PlayCoin(lua_State* L)
 {
+#if POOK_SOUND
 	tsPlaySound(ts_ctx, coin_def);
+#endif
 	return 0;
 }
 
 int PlayDeathSound(lua_State* L)
 {
+#if POOK_SOUND
 	tsPlaySound(ts_ctx, death_def);
+#endif
 	return 0;
 }
 
 void ResetGameState()
 {
 	t = 0;
+	FreeScripts( );
+	FreeInstanceBuffers( );
 	L = luaL_newstate( );
 	luaL_openlibs( L );
+	lua_pushboolean( L, POOK_HEADLESS );
+	lua_setglobal( L, "HEADLESS" );
 	Register( L, PushMesh );
+	Register( L, GetMesh );
+	Register( L, GetRender );
 	Register( L, PushVert_internal );
 	Register( L, PushInstance_internal );
 	Register( L, UpdateCam );
@@ -1363,16 +4080,317 @@ void ResetGameState()
 	Register(L, PlayCoin);
 	Register(L, PlayJump);
 	Register(L, ResetGameFromLua);
+	Register( L, RunScript );
+	Register( L, MakeInstanceBuffer );
+	Register( L, SubmitInstances );
+	Register( L, GetCullStats );
+	RegisterInstanceBuffer( L );
+	RegisterV3( L );
 	Dofile( L, "src/core/init.lua" );
 }
 
+// Scales the resolution the scene renders at, before post processing stretches
+// it over the window, to keep the GPU's frame time within GPU_FRAME_BUDGET_MS.
+// Off for headless runs so benchmarks stay comparable.
+#ifndef DYNAMIC_RESOLUTION
+	#define DYNAMIC_RESOLUTION !POOK_HEADLESS
+#endif
+#define RENDER_SCALE_MIN 0.5f
+#define RENDER_SCALE_MAX 1.0f
+#define RENDER_SCALE_STEP 0.05f
+
+// a bit under a 60Hz vsync interval, leaving the CPU and driver some slack
+#define GPU_FRAME_BUDGET_MS 14.0f
+
+// Feeds the GPU time of a past frame into render_scale. Scene cost goes with
+// pixel count, the square of the scale, while post processing always runs at
+// window size and does not scale. Moves a fraction of the way each frame since
+// timings arrive TG_GPU_TIMER_FRAMES late, and snaps to RENDER_SCALE_STEP so the
+// resolution does not crawl every frame.
+void UpdateRenderScale( void* ctx )
+{
+	// render_scale of the frames whose timings are still in flight
+	static float applied[ TG_GPU_TIMER_FRAMES ];
+	static unsigned frame;
+	float measured_scale = applied[ frame % TG_GPU_TIMER_FRAMES ];
+	applied[ frame++ % TG_GPU_TIMER_FRAMES ] = render_scale;
+
+	static tgGpuTime* times;
+	static uint32_t capacity;
+	uint32_t count = tgGetGpuTimeCount( ctx );
+	if ( count > capacity )
+	{
+		capacity = count;
+		free( times );
+		times = (tgGpuTime*)malloc( sizeof( tgGpuTime ) * capacity );
+	}
+	count = tgGetGpuTimes( ctx, times, count );
+	if ( !count || measured_scale <= 0 ) return;
+
+	double scene_ms = 0;
+	double post_ms = 0;
+	for ( uint32_t i = 0; i < count; ++i )
+	{
+		double ms = (double)times[ i ].nanoseconds / 1000000.0;
+		if ( times[ i ].key == TG_POST_FX_KEY ) post_ms += ms;
+		else scene_ms += ms;
+	}
+
+	double budget = GPU_FRAME_BUDGET_MS - post_ms;
+	if ( scene_ms <= 0 || budget <= 0 ) return;
+
+	// the scale that would just fit the budget
+	static float scale = 1.0f;
+	float target = measured_scale * (float)sqrt( budget / scene_ms );
+	if ( target < RENDER_SCALE_MIN ) target = RENDER_SCALE_MIN;
+	if ( target > RENDER_SCALE_MAX ) target = RENDER_SCALE_MAX;
+	scale += (target - scale) * 0.1f;
+
+	float snapped = floorf( scale / RENDER_SCALE_STEP + 0.5f ) * RENDER_SCALE_STEP;
+	if ( snapped < RENDER_SCALE_MIN ) snapped = RENDER_SCALE_MIN;
+	if ( snapped > RENDER_SCALE_MAX ) snapped = RENDER_SCALE_MAX;
+	if ( snapped != render_scale )
+	{
+		render_scale = snapped;
+		tgSetFramebufferScale( &fbo, render_scale );
+	}
+}
+
+#define PROFILE_FRAMES 120
+#define PROFILE_MAX_SCOPES 32
+#define PROFILE_MAX_DEPTH 8
+#define PROFILE_MAX_GPU_TIMES 256
+
+typedef struct
+{
+	const char* name;
+	double start;
+	double end;
+} ProfileScope;
+
+// GPU times arrive TG_GPU_TIMER_FRAMES frames late and are filled into the
+// frame they were measured in. Timer queries give durations only, so the trace
+// lays a frame's draws out back to back from the moment tgFlush started.
+typedef struct
+{
+	unsigned number;
+	double flush;
+	int scope_count;
+	ProfileScope scopes[ PROFILE_MAX_SCOPES ];
+	int gpu_count;
+	tgGpuTime gpu[ PROFILE_MAX_GPU_TIMES ];
+} ProfileFrame;
+
+typedef struct
+{
+	unsigned frame_count;
+	int depth;
+	int open[ PROFILE_MAX_DEPTH ];
+	ProfileFrame frames[ PROFILE_FRAMES ];
+} Profiler;
+
+Profiler profiler;
+
+ProfileFrame* ProfileCurrent( )
+{
+	return profiler.frames + (profiler.frame_count - 1) % PROFILE_FRAMES;
+}
+
+void ProfileFrameBegin( )
+{
+	ProfileFrame* frame = profiler.frames + profiler.frame_count % PROFILE_FRAMES;
+	frame->number = profiler.frame_count++;
+	frame->flush = 0;
+	frame->scope_count = 0;
+	frame->gpu_count = 0;
+	profiler.depth = 0;
+}
+
+// Opens a CPU scope in the current frame, closed by the matching ProfileEnd.
+// Scopes nest. name must outlive the profiler, string literals are best.
+void ProfileBegin( const char* name )
+{
+	if ( !profiler.frame_count ) return;
+	ProfileFrame* frame = ProfileCurrent( );
+	if ( frame->scope_count == PROFILE_MAX_SCOPES || profiler.depth == PROFILE_MAX_DEPTH ) return;
+
+	ProfileScope* scope = frame->scopes + frame->scope_count;
+	scope->name = name;
+	scope->start = glfwGetTime( );
+	scope->end = scope->start;
+	profiler.open[ profiler.depth++ ] = frame->scope_count++;
+}
+
+void ProfileEnd( )
+{
+	if ( !profiler.depth ) return;
+	ProfileFrame* frame = ProfileCurrent( );
+	frame->scopes[ profiler.open[ --profiler.depth ] ].end = glfwGetTime( );
+}
+
+// Call right after tgFlush, it also records when the flush started.
+void ProfileGpu( void* ctx, double flush_start )
+{
+	if ( !profiler.frame_count ) return;
+	ProfileCurrent( )->flush = flush_start;
+	if ( profiler.frame_count <= TG_GPU_TIMER_FRAMES ) return;
+
+	unsigned number = profiler.frame_count - 1 - TG_GPU_TIMER_FRAMES;
+	ProfileFrame* frame = profiler.frames + number % PROFILE_FRAMES;
+	if ( frame->number != number ) return;
+	frame->gpu_count = (int)tgGetGpuTimes( ctx, frame->gpu, PROFILE_MAX_GPU_TIMES );
+}
+
+// Names a draw by the render or mesh its key was made for, see DrawKey. Past
+// STATE_ID_MASK handles wrap, and the name is that of the first one sharing the id.
+const char* DrawKeyName( uint64_t key )
+{
+	if ( key == TG_POST_FX_KEY ) return "post fx";
+	if ( key == TG_SCENE_KEY ) return "scene";
+
+	tgRenderState state;
+	state.key = key;
+	int handle = state.state / 2;
+	if ( state.state % 2 ) return handle < meshes.mesh_count ? meshes.mesh_names[ handle ] : "mesh";
+	return handle < meshes.render_count ? meshes.render_names[ handle ] : "render";
+}
+
+void ProfileEvent( FILE* fp, int* first, const char* name, int tid, double start, double duration )
+{
+	fprintf( fp, "%s\n\t\t{ \"name\": \"%s\", \"ph\": \"X\", \"pid\": 0, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f }", *first ? "" : ",", name, tid, start * 1000000.0, duration * 1000000.0 );
+	*first = 0;
+}
+
+// Writes the frames in the ring as a Chrome trace, CPU scopes on thread 0 and
+// GPU draws on thread 1.
+void ProfileDump( const char* path )
+{
+	FILE* fp = fopen( path, "w" );
+	if ( !fp )
+	{
+		printf( "Could not write profile to %s\n", path );
+		return;
+	}
+
+	fprintf( fp, "{\n\t\"traceEvents\": [" );
+	fprintf( fp, "\n\t\t{ \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": 0, \"args\": { \"name\": \"CPU\" } }," );
+	fprintf( fp, "\n\t\t{ \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": 1, \"args\": { \"name\": \"GPU\" } }" );
+	int first = 0;
+
+	unsigned count = profiler.frame_count < PROFILE_FRAMES ? profiler.frame_count : PROFILE_FRAMES;
+	for ( unsigned i = profiler.frame_count - count; i < profiler.frame_count; ++i )
+	{
+		ProfileFrame* frame = profiler.frames + i % PROFILE_FRAMES;
+		for ( int j = 0; j < frame->scope_count; ++j )
+		{
+			ProfileScope* scope = frame->scopes + j;
+			ProfileEvent( fp, &first, scope->name, 0, scope->start, scope->end - scope->start );
+		}
+
+		double at = frame->flush;
+		for ( int j = 0; j < frame->gpu_count; ++j )
+		{
+			double duration = (double)frame->gpu[ j ].nanoseconds / 1000000000.0;
+			ProfileEvent( fp, &first, DrawKeyName( frame->gpu[ j ].key ), 1, at, duration );
+			at += duration;
+		}
+	}
+
+	fprintf( fp, "\n\t]\n}\n" );
+	fclose( fp );
+	printf( "Wrote the last %u frames of profile to %s\n", count, path );
+}
+
+#if POOK_PROFILE
+	#define PROFILE_FRAME_BEGIN( ) ProfileFrameBegin( )
+	#define PROFILE_BEGIN( name ) ProfileBegin( name )
+	#define PROFILE_END( ) ProfileEnd( )
+	#define PROFILE_GPU( ctx, flush_start ) ProfileGpu( ctx, flush_start )
+#else
+	#define PROFILE_FRAME_BEGIN( )
+	#define PROFILE_BEGIN( name )
+	#define PROFILE_END( )
+	#define PROFILE_GPU( ctx, flush_start )
+#endif
+
 int RandomInt( int lo, int hi )
 {
 	return lo + rand( ) / (RAND_MAX / (hi - lo + 1) + 1);
 }
 
-int main( )
+#if POOK_HEADLESS
+
+// Per-frame timings for headless runs. CPU time covers input, scripts, the
+// wave and vert expansion up to the draw call submission. Render time covers
+// tgFlush plus a glFinish, so it includes the rasterizer's work.
+typedef struct
+{
+	unsigned frames;
+	double cpu_total;
+	double cpu_max;
+	double render_total;
+	double render_max;
+	double state_issued;
+	double state_elided;
+	double instances_drawn;
+	double instances_culled;
+} Benchmark;
+
+// call once the frame is flushed, tinygl's and the culling counters are read from there
+void BenchmarkFrame( Benchmark* bench, void* ctx, unsigned frame, double cpu, double render )
+{
+	tgStateStats state = tgGetStateStats( ctx );
+	CullStats cull = last_cull_stats;
+	bench->cpu_total += cpu;
+	bench->render_total += render;
+	bench->state_issued += state.issued;
+	bench->state_elided += state.elided;
+	bench->instances_drawn += cull.drawn;
+	bench->instances_culled += cull.culled;
+	if ( cpu > bench->cpu_max ) bench->cpu_max = cpu;
+	if ( render > bench->render_max ) bench->render_max = render;
+	printf( "%u,%.3f,%.3f,%u,%u,%d,%d\n", frame, cpu * 1000.0, render * 1000.0, state.issued, state.elided, cull.drawn, cull.culled );
+}
+
+// times any render or mesh waited on the GPU for a stream buffer, see tgStallCount
+uint32_t StreamStallCount( )
+{
+	uint32_t stalls = 0;
+	for ( int i = 0; i < meshes.render_count; ++i ) stalls += tgStallCount( &meshes.calls[ i ].r );
+	for ( int i = 0; i < meshes.mesh_count; ++i ) stalls += tgStallCount( &meshes.meshes[ i ].r );
+	return stalls;
+}
+
+void BenchmarkReport( Benchmark* bench )
+{
+	double n = bench->frames ? (double)bench->frames : 1.0;
+	printf( "frames: %u\n", bench->frames );
+	printf( "cpu ms: avg %.3f, max %.3f\n", bench->cpu_total * 1000.0 / n, bench->cpu_max * 1000.0 );
+	printf( "render ms: avg %.3f, max %.3f\n", bench->render_total * 1000.0 / n, bench->render_max * 1000.0 );
+	printf( "GL state changes per frame: issued %.1f, elided %.1f\n", bench->state_issued / n, bench->state_elided / n );
+	printf( "instances per frame: drawn %.1f, culled %.1f\n", bench->instances_drawn / n, bench->instances_culled / n );
+	printf( "GPU stream stalls: %u\n", StreamStallCount( ) );
+}
+
+#endif
+
+int main( int argc, char** argv )
 {
+#if POOK_HEADLESS
+	Benchmark bench = { 0 };
+	bench.frames = 600;
+#endif
+
+	for ( int i = 1; i < argc; ++i )
+	{
+		if ( !strncmp( argv[ i ], "--wave=", 7 ) ) SetWaveSize( argv[ i ] + 7 );
+		else if ( !strcmp( argv[ i ], "--gpu-wave" ) ) gpu_wave.enabled = 1;
+#if POOK_HEADLESS
+		else bench.frames = (unsigned)atoi( argv[ i ] );
+#endif
+	}
+
+#if POOK_SOUND
 	int frequency = 44100; // a good standard frequency for playing commonly saved OGG + wav files
 	int latency_in_Hz = 15; // a good latency, too high will cause artifacts, too low will create noticeable delays
 	int buffered_seconds = 5; // number of seconds the buffer will hold in memory. want this long enough in case of frame-delays
@@ -1394,6 +4412,7 @@ int main( )
 	jump_def = tsMakeDef(&jump);
 	coin_def = tsMakeDef(&coin);
 	death_def = tsMakeDef(&death);
+#endif
 
 	SetCDW( );
 	ResetGameState();
@@ -1405,7 +4424,10 @@ int main( )
 
 	glfwWindowHint( GLFW_CONTEXT_VERSION_MAJOR, 3 );
 	glfwWindowHint( GLFW_CONTEXT_VERSION_MINOR, 2 );
+#if !POOK_HEADLESS
+	// OSMesa refuses forward compatible contexts
 	glfwWindowHint( GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE );
+#endif
 	glfwWindowHint( GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE );
 
 	int width = 1200;
@@ -1426,21 +4448,29 @@ int main( )
 
 	glfwMakeContextCurrent( window );
 	gladLoadGLLoader( (GLADloadproc)glfwGetProcAddress );
-	glfwSwapInterval( 1 );
+	glfwSwapInterval( POOK_HEADLESS ? 0 : 1 );
 
 	glfwGetFramebufferSize( window, &width, &height );
 	Reshape( window, width, height );
 
-	void* ctx = tgMakeCtx( 32, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, GL_DEPTH_TEST );
+	void* ctx = tgMakeCtx( INITIAL_FRAME_DRAW_CALLS, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, GL_DEPTH_TEST );
+	tgMakeUniformBlock( ctx, &frame_block, FRAME_UNIFORMS_BINDING );
+	// the profiler wants every draw, dynamic resolution only the scene's total
+	tgEnableGpuTimers( ctx, POOK_PROFILE ? TG_GPU_TIMERS_DRAWS : DYNAMIC_RESOLUTION ? TG_GPU_TIMERS_SCENE : TG_GPU_TIMERS_OFF );
 
 #if 1
-	glEnable( GL_CULL_FACE );
+	tgSetCulling( ctx, 1 );
 	glEnable( GL_DEPTH_TEST );
 	glCullFace( GL_BACK );
 	glFrontFace( GL_CCW );
 #endif
 
+	InitMeshes( );
+	InitWave( );
+
 	SetUpRenderable(GL_TRIANGLES, "simple", "./assets/shaders/simple.vs", "./assets/shaders/simple.ps");
+	if ( gpu_wave.enabled ) InitGpuWave( ctx );
+	else InitWaveRender( );
 	//SetUpRenderable(GL_QUADS, "quads", "./assets/shaders/simple.vs", "./assets/shaders/simple.ps");
 
 	LookAt( cam, V3( 0, 0, 5 ), V3( 0, 0, 0 ), V3( 0, 1, 0 ) );
@@ -1448,35 +4478,63 @@ int main( )
 	m4Mul( projection, cam, mvp );
 	UpdateMvp();
 
-	InitMeshes( );
+	InitExpandWorkers( );
 	MakeMeshes( L );
 
-	InitWave( );
 	unsigned frame_count = 0;
 
 	tgShader postProcessShader;
 	char* vs = (char*)ReadFileToMemory( "./assets/shaders/postprocess.vs", 0 );
 	char* ps = (char*)ReadFileToMemory( "./assets/shaders/postprocess.ps", 0 );
 	tgLoadShader(&postProcessShader, vs, ps);
-	tgFramebuffer fbo;
+	tgBindUniformBlock( &postProcessShader, "Frame", &frame_block );
 	tgMakeFramebuffer(&fbo, &postProcessShader, width, height);
 
 	double time_accum = 0;
 	glClearColor( 0.0f, 0.35f, 1.0f, 1.0f );
+#if POOK_HEADLESS
+	printf( "frame,cpu_ms,render_ms,state_issued,state_elided,instances_drawn,instances_culled\n" );
+	while ( frame_count < bench.frames )
+#else
 	while ( !glfwWindowShouldClose( window ) )
+#endif
 	{
+#if POOK_HEADLESS
+		double frame_start = glfwGetTime( );
+		dt = 1.0f / 60.0f;
+#else
 		glfwPollEvents( );
-
 		dt = ttTime( );
+#endif
 		t += dt;
-		UpdateTimeUniform(fbo.shader);
+		PROFILE_FRAME_BEGIN( );
+		UpdateTimeUniform();
+		PROFILE_BEGIN( "DoPlayerCollision" );
 		DoPlayerCollision( );
+		PROFILE_END( );
+		PROFILE_BEGIN( "DetectWaveCollision" );
 		if ( !DetectWaveCollision( ) ) WAVE_DEBOUNCE = 0;
+		PROFILE_END( );
+		PROFILE_BEGIN( "Tick" );
 		Tick( L, dt );
+		PROFILE_END( );
+#if POOK_SOUND
+		PROFILE_BEGIN( "tsMix" );
 		tsMix( ts_ctx );
+		PROFILE_END( );
+#endif
 
-		SolveWave( dt );
-		DrawWave( );
+		PROFILE_BEGIN( "SolveWave" );
+		if ( gpu_wave.enabled ) SolveGpuWave( dt );
+		else SolveWave( dt );
+		PROFILE_END( );
+		PROFILE_BEGIN( "DrawWave" );
+		if ( gpu_wave.enabled ) DrawGpuWave( );
+		else DrawWave( );
+		PROFILE_END( );
+		PROFILE_BEGIN( "RunExpandJobs" );
+		RunExpandJobs( );
+		PROFILE_END( );
 
 		time_accum += dt;
 		WAVE_HEIGHT_VARIANCE = sinf( -time_accum / (3.14159f * 2.0f) ) * 100.0f;
@@ -1498,28 +4556,83 @@ int main( )
 				tgDrawCall call;
 				call.r = &dc->r;
 				call.texture_count = 0;
-				call.verts = dc->verts;
 				call.vert_count = dc->count;
+#if ZERO_COPY_STREAMING
+				call.verts = 0;
+#else
 				call.verts = dc->verts;
+#endif
+				call.instances = (void*)&identity_instance;
+				call.instance_count = 1;
+
+				// streamed verts are already in world space and span the scene, no single depth
+				call.state.key = DrawKey( &dc->r, RENDER_STATE_ID( i ), 0 );
 				tgPushDrawCall( ctx, call );
 				dc->count = 0;
 			}
 		}
 
+		for ( int i = 0; i < meshes.mesh_count; ++i )
+		{
+			Mesh* mesh = meshes.meshes + i;
+			if ( mesh->instance_count )
+			{
+				tgDrawCall call;
+				call.r = &mesh->r;
+				call.texture_count = 0;
+				call.verts = 0;
+				call.vert_count = mesh->vert_count;
+				call.instances = mesh->instances;
+				call.instance_count = mesh->instance_count;
+				call.state.key = DrawKey( &mesh->r, MESH_STATE_ID( i ), NearestInstanceDepth( mesh ) );
+				tgPushDrawCall( ctx, call );
+				mesh->instance_count = 0;
+			}
+		}
+
+		last_cull_stats = cull_stats;
+		memset( &cull_stats, 0, sizeof( cull_stats ) );
+
 		glfwSetCursorPos( window, 600, 600 );
 		if ( mouse_moved )
 		{
 			// glfwSetCursorPos( window, 600, 600 );
 			mouse_moved = 0;
 		}
+		double render_start = glfwGetTime( );
+		PROFILE_BEGIN( "tgFlush" );
 		tgFlush( ctx, PookSwapBuffers, &fbo );
+		PROFILE_END( );
+		PROFILE_GPU( ctx, render_start );
+#if DYNAMIC_RESOLUTION
+		UpdateRenderScale( ctx );
+#endif
+#if POOK_HEADLESS
+		glFinish( );
+		BenchmarkFrame( &bench, ctx, frame_count, render_start - frame_start, glfwGetTime( ) - render_start );
+#endif
 		TG_PRINT_GL_ERRORS( );
 		++frame_count;
 	}
 
+#if POOK_HEADLESS
+	BenchmarkReport( &bench );
+#endif
+
+#if POOK_PROFILE
+	ProfileDump( PROFILE_PATH );
+#endif
+
+#if POOK_SOUND
 	tsShutdownContext( ts_ctx );
+#endif
 	lua_close( L );
+	FreeExpandWorkers( );
+	FreeGpuWave( );
+	FreeWave( );
 	FreeMeshes( );
+	FreeInstanceBuffers( );
+	tgFreeUniformBlock( &frame_block );
 	tgFreeCtx( ctx );
 	glfwDestroyWindow( window );
 	glfwTerminate( );
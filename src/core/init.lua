@@ -1,10 +1,11 @@
-dofile("src/util/fileloader.lua")
+RunScript("src/util/fileloader.lua")
 
 -- globals
 s = math.sin
 c = math.cos
 world = {}
-math.randomseed(os.time())
+-- fixed seed so headless benchmark runs are reproducible
+math.randomseed(HEADLESS and 1 or os.time())
 GRAVITY = 150
 
 THE_COINS = {}
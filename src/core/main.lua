@@ -1,6 +1,8 @@
-dofile("src/util/fileloader.lua")
+RunScript("src/util/fileloader.lua")
 
 for i, v in pairs(world) do
 	v:Update()
 	v:Render()
-end
\ No newline at end of file
+end
+
+SubmitInstanceBuffers()
\ No newline at end of file
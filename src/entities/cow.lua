@@ -6,6 +6,10 @@ function GenerateCow()
 	cow.p = v3(math.random(-5, 5), math.random(-5, 5), math.random(-5, 5))
 	cow.spinAngle = 0
 	cow.alive = true
+	cow.instances = GetInstanceBuffer("simple", "triangle")
+	cow.slot = cow.instances:Add()
+	cow.instances:Set(cow.slot, 0, 0, 0, .5, .5, .5)
+	cow.instances:SetActive(cow.slot, false)
 
 	cow.id = THE_COIN_ID
 	THE_COIN_ID = THE_COIN_ID + 1
@@ -23,11 +27,9 @@ function GenerateCow()
 
 	cow.Render = function(self)
 		if not self.alive then return end
-		local angle = self.spinAngle
-		local rx = 0
-		local ry = 1
-		local rz = 0
-		PushInstance( "simple", "triangle", self.p.x, self.p.y, self.p.z, .5, .5, .5, rx, ry, rz, angle)
+		local d, o = self.instances.data, self.slot
+		d[o + 1], d[o + 2], d[o + 3] = self.p.x, self.p.y, self.p.z
+		d[o + 10], d[o + 11] = self.spinAngle, 1
 	end
 
 	cow.Update = function(self)
@@ -21,8 +21,12 @@ local function GenerateMesh(self)
 	GeneratedMeshes["platform"] = true
 end
 
+-- platforms don't move, their instance transform is only written when placed
 local function Render(self)
-	PushInstance("simple", "cube", self.p.x, self.p.y, self.p.z, self.s.x, self.s.y, self.s.z)
+end
+
+local function UpdateInstance(self)
+	self.instances:Set(self.slot, self.p.x, self.p.y, self.p.z, self.s.x, self.s.y, self.s.z)
 end
 
 local function Update(self)
@@ -46,11 +50,14 @@ function GeneratePlatform()
 
 	platform.p = v3(0, 0, 0)
 	platform.s = v3(0, 0, 0)
+	platform.instances = GetInstanceBuffer("simple", "cube")
+	platform.slot = platform.instances:Add()
 
 	platform.GenerateMesh = GenerateMesh
 	platform.Render = Render
 	platform.Update = Update
 	platform.AddCollider = AddCollider
+	platform.UpdateInstance = UpdateInstance
 
 	-- function platform.init() end
 	platform.Init = function(self, x, y, z, sx, sy, sz)
@@ -82,6 +89,7 @@ function GeneratePlatform()
 
 		local p = self.p
 		local s = self.s
+		self:UpdateInstance()
 
 		table.insert(platforms, self) -- clean this up if we switch levels.
 	end
@@ -76,15 +76,16 @@ local function Update(self)
 		PlayJump()
 	end
 
+	grav = grav or v3()
 	if not self:TouchingGround() then
-		grav = v3( 0, -GRAVITY, 0 )
+		grav:set( 0, -GRAVITY, 0 )
 	else
-		grav = v3(0, 0, 0)
+		grav:set( 0, 0, 0 )
 	end
 
-	self.v = self.v + grav * dt
+	self.v:addScaled( grav, dt )
 	self.v.y = math.max(self.v.y, -60)
-	self.p = self.p + self.v * dt
+	self.p:addScaled( self.v, dt )
 
 	-- ghetto ground collision
 	if self.p.y < WORLD_BOTTOM then
@@ -98,9 +99,10 @@ local function Update(self)
 
 	-- collide with coins and remove them
 	for k, v in pairs( THE_COINS ) do
-		local dist = length(v.p - player.p)
+		local dist = v.p:distance( player.p )
 		if dist < (playerRadius + 2) then
 			v.alive = false
+			v.instances:SetActive(v.slot, false)
 			THE_COINS[ k ] = nil
 			ResetGameTime()
 			PlayCoin()
@@ -113,7 +115,7 @@ local function Update(self)
 
 	if sharks then
 		for k, v in pairs(sharks) do
-			local dist = length(v.p - player.p)
+			local dist = v.p:distance( player.p )
 			if dist < (playerRadius + SHARK_RADIUS) then
 				ResetGameFromLua()
 			end
@@ -133,6 +135,9 @@ function GeneratePlayer()
 
 	player.p = v3(0, 0, 0)
 	player.v = v3(0, 0, 0)
+	player.instances = GetInstanceBuffer("simple", "playerTriangles")
+	player.slot = player.instances:Add()
+	player.instances:Set(player.slot, 0, 0, 0, .5, .5, .5)
 
 	player.jumping = false
 	player.touching_ground = false;
@@ -142,7 +147,8 @@ function GeneratePlayer()
 	end
 
 	player.Render = function(self)
-		PushInstance("simple", "playerTriangles", self.p.x, self.p.y, self.p.z, .5, .5, .5)
+		local d, o = self.instances.data, self.slot
+		d[o + 1], d[o + 2], d[o + 3] = self.p.x, self.p.y, self.p.z
 	end
 
 	-- clean this up later with some metatables
@@ -20,10 +20,14 @@ function GenerateShark()
 	shark.p = v3(0, 0, 0)
 	shark:PlaceShark()
 	shark.s = v3(2, 2, 2)
+	shark.instances = GetInstanceBuffer("simple", "shark")
+	shark.slot = shark.instances:Add()
+	shark.instances:Set(shark.slot, 0, 0, 0, shark.s.x, shark.s.y, shark.s.z, 1, 0, 0, 4.71239)
 	shark.jumpTarget = GetJumpTarget()
 	shark.velocity = SHARK_SPEED
 	shark.falling = false
-	shark.nextJumpTime = os.time() + math.random(0, 4)
+	-- jumps are scheduled in game time, t from Tick, so they follow dt and not the wall clock
+	shark.nextJumpTime = (t or 0) + math.random(0, 4)
 
 	shark.GenerateMesh = function(self)
 		if GeneratedMeshes["shark"] ~= nil then
@@ -36,11 +40,12 @@ function GenerateShark()
 	end
 
 	shark.Render = function(self)
-		PushInstance("simple", "shark", self.p.x, self.p.y, self.p.z, self.s.x, self.s.y, self.s.z, 1, 0, 0, 4.71239)
+		local d, o = self.instances.data, self.slot
+		d[o + 1], d[o + 2], d[o + 3] = self.p.x, self.p.y, self.p.z
 	end
 
 	shark.Update = function(self)
-		if (not self.falling) and os.time() < self.nextJumpTime then return end
+		if (not self.falling) and t < self.nextJumpTime then return end
 
 		self.p.y = self.p.y + self.velocity * dt
 		if self.p.y > self.jumpTarget and not self.falling then
@@ -51,7 +56,7 @@ function GenerateShark()
 			shark:PlaceShark()
 			self.falling = false
 			self.jumpTarget = GetJumpTarget()
-			self.nextJumpTime = os.time() + math.random(3, 6)
+			self.nextJumpTime = t + math.random(3, 6)
 		end
 	end
 
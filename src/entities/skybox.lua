@@ -13,8 +13,8 @@ local function GenerateMesh()
 		F,B,A,E,D,E,A,D,G,E,F,C,B,H,C,F}, "skybox")
 end
 
+-- static, the instance transform is written once in GenerateSkybox
 local function Render(self)
-	PushInstance("simple", "skybox", 0, 0, 0, self.s.x, self.s.y, self.s.z)
 end
 
 function GenerateSkybox()
@@ -23,6 +23,9 @@ function GenerateSkybox()
 	skybox.s = v3(500, 500, 500)
 	skybox.Render = Render
 	skybox.Update = function() end
+	skybox.instances = GetInstanceBuffer("simple", "skybox")
+	skybox.slot = skybox.instances:Add()
+	skybox.instances:Set(skybox.slot, 0, 0, 0, skybox.s.x, skybox.s.y, skybox.s.z)
 
 	table.insert(world, skybox)
 end
@@ -61,6 +61,7 @@ function GenerateLevel(numPlatforms)
 
 	local midPlat = platforms[math.floor(#platforms/2)];
 	midPlat.p.y = midPlat.p.y + 15
+	midPlat:UpdateInstance()
 	player.p = v3(midPlat.p.x, midPlat.p.y + midPlat.s.y + 5, midPlat.p.z)
 
 	for i, v in pairs(platforms) do
@@ -2,6 +2,72 @@ if GeneratedMeshes == nil then
 	GeneratedMeshes = {}
 end
 
+if InstanceBuffers == nil then
+	InstanceBuffers = {}
+	InstanceBufferList = {}
+end
+
+-- Each slot of a buffer is INSTANCE_FLOATS floats in buffer.data, starting
+-- after the offset Add returns:
+--   o + 1..3 position, o + 4..6 scale, o + 7..9 rotation axis, o + 10 angle,
+--   o + 11 active (1 or 0)
+-- Entities write moving fields straight into buffer.data, so updating a slot
+-- never calls into C. SubmitInstanceBuffers hands each array over once a frame.
+INSTANCE_FLOATS = 11
+
+InstanceBuffer = {}
+InstanceBuffer.__index = InstanceBuffer
+
+-- Returns the offset of a new slot. Slots start out hidden until their first Set.
+function InstanceBuffer:Add( )
+	local o = self.count * INSTANCE_FLOATS
+	local d = self.data
+	d[ o + 1 ], d[ o + 2 ], d[ o + 3 ] = 0, 0, 0
+	d[ o + 4 ], d[ o + 5 ], d[ o + 6 ] = 1, 1, 1
+	d[ o + 7 ], d[ o + 8 ], d[ o + 9 ] = 0, 1, 0
+	d[ o + 10 ], d[ o + 11 ] = 0, 0
+	self.count = self.count + 1
+	return o
+end
+
+-- buffer:Set( o, x, y, z, sx, sy, sz, rx, ry, rz, ra ), same defaults as PushInstance
+function InstanceBuffer:Set( o, x, y, z, sx, sy, sz, rx, ry, rz, ra )
+	local d = self.data
+	d[ o + 1 ], d[ o + 2 ], d[ o + 3 ] = x or 0, y or 0, z or 0
+	d[ o + 4 ], d[ o + 5 ], d[ o + 6 ] = sx or 1, sy or 1, sz or 1
+	d[ o + 7 ], d[ o + 8 ], d[ o + 9 ] = rx or 0, ry or 1, rz or 0
+	d[ o + 10 ], d[ o + 11 ] = ra or 0, 1
+end
+
+function InstanceBuffer:SetActive( o, active )
+	self.data[ o + 11 ] = active and 1 or 0
+end
+
+function InstanceBuffer:Clear( )
+	self.data = {}
+	self.count = 0
+end
+
+-- one buffer per render/mesh pair, entities Add a slot and write it in place
+function GetInstanceBuffer( render_name, mesh_name )
+	local key = render_name .. ":" .. mesh_name
+	local buffer = InstanceBuffers[ key ]
+	if buffer == nil then
+		buffer = setmetatable( { handle = MakeInstanceBuffer( render_name, mesh_name ), data = {}, count = 0 }, InstanceBuffer )
+		InstanceBuffers[ key ] = buffer
+		table.insert( InstanceBufferList, buffer )
+	end
+	return buffer
+end
+
+-- in creation order, so draws are pushed in the same order every run
+function SubmitInstanceBuffers( )
+	for i, v in ipairs( InstanceBufferList ) do
+		SubmitInstances( v.handle, v.data, v.count )
+	end
+end
+
+-- mesh_name and shader_name can also be handles from GetMesh/GetRender/PushMesh
 function PushInstance( mesh_name, shader_name, x, y, z, sx, sy, sz, rx, ry, rz, ra )
 	x = x or 0; y = y or 0; z = z or 0;
 	sx = sx or 1; sy = sy or 1; sz = sz or 1;
@@ -42,5 +108,5 @@ function PushMeshLua(verts, name, color, convert)
 		end
 	end
 
-	PushMesh(name)
+	return PushMesh(name)
 end
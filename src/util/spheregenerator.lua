@@ -6,12 +6,12 @@ local function Subdivide(points, r)
 		local b = v3(points[i + 1])
 		local c = v3(points[i + 2])
 
-		local ab = (a + b) / 2
-		local bc = (b + c) / 2
-		local ca = (c + a) / 2
+		local ab = v3(a):add(b):scale(0.5)
+		local bc = v3(b):add(c):scale(0.5)
+		local ca = v3(c):add(a):scale(0.5)
 
 		for ii, vv in pairs({b, bc, ab, c, ca, bc, a, ab, ca, ab, bc, ca}) do
-			out[j] = vv:normalized() * r
+			out[j] = v3(vv):normalize():scale(r)
 			j = j + 1
 		end
 	end
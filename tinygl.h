@@ -24,7 +24,7 @@
 	5. compose draw calls
 	6. flush
 
-	1. void* ctx = tgMakeCtx( max_draw_calls_per_flush, clear_bits, settings_bits )
+	1. void* ctx = tgMakeCtx( initial_draw_calls_per_flush, clear_bits, settings_bits )
 	2. tgMakeVertexData( ... ) and tgAddAttribute( ... )
 	3. tgLoadShader( &shader_instance, vertex_shader_string, pixel_shader_string )
 	4. tgMakeRenderable( &renderable_instance, &vertex_data_instance )
@@ -45,6 +45,30 @@
 	Post processing fx are done with a frame buffer, and are done only once with
 	one shader, after all draw calls have been processed.
 
+	Instanced renderables are made with tgMakeInstancedRenderable and a second
+	tgVertexData describing per-instance attributes. The mesh vertices can be
+	static (uploaded once), while the instance stream is always dynamic and triple
+	buffered just like dynamic vertices. Each draw call then supplies instances
+	and instance_count alongside its verts, and is drawn with glDrawArraysInstanced.
+
+	Static renderables can also be indexed. tgUploadIndices stores an element
+	buffer next to the verts, 16 bit when the verts allow it, and from then on the
+	renderable draws with glDrawElements( Instanced ) over all of its indices.
+
+	Draw calls are ordered by the 64 bit key in their tgRenderState. tgFlush radix
+	sorts (key, index) pairs, never moving the calls themselves, and calls with equal
+	keys keep the order they were pushed in. Filling in the key is up to the user,
+	tgDepthKey quantizes view depth for the depth field.
+
+	Each renderable keeps its own vertex array objects, and tgRender skips program,
+	VAO, texture and face culling changes that are already current, so runs of
+	calls sharing state cost little more than the draws. tgGetStateStats reports
+	how many binds were issued and how many were skipped.
+
+	tgEnableGpuTimers wraps each draw and the post processing pass in a
+	GL_TIME_ELAPSED query. Results are read back TG_GPU_TIMER_FRAMES flushes
+	later through tgGetGpuTimes, once the GPU is done with them.
+
 	For full examples of use please visit either of these links:
 		example to render various 2d shapes + post fx
 			https://github.com/RandyGaul/tinyheaders/tree/master/examples_tinygl_and_tinyc2
@@ -60,10 +84,8 @@
 
 /*
 	Some Current Limitations
-		* No index support. Adding indices would not be too hard and come down to a
-			matter of adding in some more triple buffer/single buffer code for
-			GL_STATIC_DRAW vs GL_DYNAMIC_DRAW.
-		* GL 3.0+ support only
+		* Indices are only supported for GL_STATIC_DRAW renderables.
+		* GL 3.0+ support only, instancing requires GL 3.3+
 		* Full support for array uniforms is not quite tested and hammered out.
 */
 
@@ -76,6 +98,11 @@
 // used to render lines over everything else (besides post fx) with no depth testing
 #define TG_LINE_RENDERER 0
 
+// Map dynamic buffers once with GL_ARB_buffer_storage (persistent + coherent)
+// instead of calling glMapBufferRange/glUnmapBuffer for every draw call. Falls
+// back to per-call mapping at runtime when the extension is missing.
+#define TG_PERSISTENT_MAPPING 1
+
 enum
 {
 	TG_FLOAT,
@@ -83,6 +110,11 @@ enum
 	TG_BOOL,
 	TG_SAMPLER,
 	TG_UNKNOWN,
+
+	// compact vertex attribute formats, see tgAddAttribute
+	TG_HALF,
+	TG_UNORM8,      // unsigned bytes read as [0, 1]
+	TG_SNORM10,     // GL_INT_2_10_10_10_REV read as [-1, 1], size must be 4
 };
 
 typedef struct
@@ -109,16 +141,22 @@ typedef struct
 
 // adjust this as necessary to create your own draw call ordering
 // see: http://realtimecollisiondetection.net/blog/?p=86
+// Calls draw in ascending key order. Bitfields fill from the low bits, so fields
+// are listed from least to most significant: calls group by layer (fullscreen,
+// hud) first, then translucency and shader, and draw front to back by depth
+// within a shader. State only breaks ties between calls at the same depth.
 typedef struct
 {
 	union
 	{
 		struct
 		{
+			uint64_t state         : 16;
+			uint64_t depth         : 24;
+			uint64_t shader        : 16;
+			uint64_t translucency  : 3;
+			uint64_t hud           : 3;
 			uint64_t fullscreen    : 2;
-			uint64_t hud           : 5;
-			uint64_t depth         : 25;
-			uint64_t translucency  : 32;
 		};
 
 		uint64_t key;
@@ -129,20 +167,52 @@ typedef struct
 struct tgShader;
 typedef struct tgShader tgShader;
 
+// GPU memory fed through tgMap. Triple buffered for GL_DYNAMIC_DRAW, single
+// buffered for GL_STATIC_DRAW. Each of the three buffers is a region guarded by
+// its own fence, placed once the stream moves on to the next region and waited
+// on before the region is written again.
 typedef struct
 {
-	tgVertexData data;
-	tgShader* program;
-	tgRenderState state;
-	uint32_t attribute_count;
-
 	uint32_t index0;
 	uint32_t index1;
 	uint32_t buffer_number;
-	uint32_t need_new_sync;
+	uint32_t need_new_sync; // static only, set until the verts are uploaded
 	uint32_t buffer_count;
 	uint32_t buffers[ 3 ];
 	GLsync fences[ 3 ];
+
+	// persistent mappings of each buffer, null when mapping per call
+	void* memory[ 3 ];
+
+	// times tgMap found the next region still in use and had to block
+	uint32_t stall_count;
+} tgStream;
+
+typedef struct
+{
+	tgVertexData data;
+	tgShader* program;
+	uint32_t attribute_count;
+	tgStream verts;
+
+	// only used by instanced renderables, see tgMakeInstancedRenderable
+	uint32_t instanced;
+	tgVertexData instance_data;
+	tgStream instances;
+
+	// Vertex array objects made on first draw, one per pair of vert and instance
+	// buffers. The instance attributes point at each draw's range of the ring, so
+	// every VAO remembers which instance its pointers were last set up for.
+	uint32_t vaos[ 3 ][ 3 ];
+	uint32_t vao_first_instance[ 3 ][ 3 ];
+
+	// element buffer, zero until tgUploadIndices
+	uint32_t index_buffer;
+	uint32_t index_count;
+	uint32_t index_type;
+
+	// set to draw with GL_CULL_FACE off, showing both sides of every triangle
+	uint32_t double_sided;
 } tgRenderable;
 
 #define TG_UNIFORM_NAME_LENGTH 64
@@ -165,6 +235,23 @@ struct tgShader
 	tgUniform uniforms[ TG_UNIFORM_MAX_COUNT ];
 };
 
+// Shader constants shared by every program that binds the block. data is the
+// caller's std140 laid out copy and is written through tgSetUniforms, so it is
+// usable before tgMakeUniformBlock runs. Dirty blocks upload to their UBO once,
+// at the start of the next tgFlush.
+typedef struct
+{
+	void* data;
+	uint32_t size;
+	uint32_t binding;
+	uint32_t ubo;
+	uint32_t dirty;
+} tgUniformBlock;
+
+// The scene renders to the lower left scene_w by scene_h of a w by h target,
+// and the post processing pass stretches that over the w by h window. Post fx
+// shaders that declare uniform vec2 u_uvScale get scene_w / w and scene_h / h
+// to scale their texture coordinates by.
 typedef struct
 {
 	uint32_t fb_id;
@@ -172,20 +259,76 @@ typedef struct
 	uint32_t rb_id;
 	uint32_t quad_id;
 	tgShader* shader;
+	int w;
+	int h;
+	int scene_w;
+	int scene_h;
+	int uv_scale_location;
 } tgFramebuffer;
 
+// Color target without depth for work done in fragment shaders, e.g. a
+// simulation ping-ponged between two targets by tgRunPass.
+typedef struct
+{
+	uint32_t fb_id;
+	uint32_t tex_id;
+	int w;
+	int h;
+} tgRenderTarget;
+
+// Reads a tgRenderTarget back to the CPU without waiting on the GPU, see
+// tgReadRedChannel.
+typedef struct
+{
+	uint32_t buffer;
+	GLsync fence;
+} tgReadback;
+
 typedef struct
 {
 	uint32_t vert_count;
 	void* verts;
+	uint32_t instance_count;
+	void* instances;
 	tgRenderable* r;
+	tgRenderState state;
 	uint32_t texture_count;
 	uint32_t textures[ 8 ];
 } tgDrawCall;
 
+// GL state changes made by tgRender (issued) and skipped because the state was
+// already current (elided), counted over one tgFlush.
+typedef struct
+{
+	uint32_t issued;
+	uint32_t elided;
+} tgStateStats;
+
+// GPU time of one draw from a GL_TIME_ELAPSED query. key is the draw call's
+// tgRenderState key, TG_SCENE_KEY for all draws of a TG_GPU_TIMERS_SCENE flush,
+// or TG_POST_FX_KEY for the post processing pass.
+typedef struct
+{
+	uint64_t key;
+	uint64_t nanoseconds;
+} tgGpuTime;
+
+#define TG_POST_FX_KEY (~0ull)
+#define TG_SCENE_KEY (~0ull - 1)
+
+// Flushes between timing a draw and reading its result back, enough for the
+// GPU to have finished so reading never stalls.
+#define TG_GPU_TIMER_FRAMES 4
+
+// max_draw_calls is only the starting capacity, tgPushDrawCall grows it as needed.
 void* tgMakeCtx( uint32_t max_draw_calls, uint32_t clear_bits, uint32_t settings_bits );
 void tgFreeCtx( void* ctx );
 
+// Turns GL_CULL_FACE on or off for every draw but those of double_sided
+// renderables. Set it here rather than with glEnable, tgRender tracks culling
+// itself and hands it back this way after every tgFlush.
+void tgSetCulling( void* ctx, int enabled );
+
 void tgLineMVP( void* context, float* mvp );
 void tgLineColor( void* context, float r, float g, float b );
 void tgLine( void* context, float ax, float ay, float az, float bx, float by, float bz );
@@ -194,12 +337,74 @@ void tgLineWidth( float width );
 void tgMakeFramebuffer( tgFramebuffer* tgFbo, tgShader* shader, int w, int h );
 void tgFreeFramebuffer( tgFramebuffer* tgFbo );
 
+// Reallocates the targets for a new window size, keeping the render scale.
+void tgResizeFramebuffer( tgFramebuffer* fb, int w, int h );
+
+// Renders the scene at scale times the window size from the next tgFlush on,
+// scale in (0, 1]. Only changes the viewport, nothing is reallocated.
+void tgSetFramebufferScale( tgFramebuffer* fb, float scale );
+
+// internal_format is a color renderable format such as GL_RGBA32F. pixels holds
+// w * h RGBA floats to start from, or null to start cleared to zero.
+void tgMakeRenderTarget( tgRenderTarget* rt, int w, int h, uint32_t internal_format, const float* pixels );
+void tgFreeRenderTarget( tgRenderTarget* rt );
+
+// Draws one triangle covering all of dst with shader s, with textures bound to
+// units 0 through texture_count - 1. Call outside of tgFlush. The shader gets
+// no attributes and should place the triangle from gl_VertexID, e.g.
+// vec2( (gl_VertexID & 1) * 4 - 1, (gl_VertexID >> 1) * 4 - 1 ). Leaves the
+// viewport at dst's size.
+void tgRunPass( void* ctx, tgShader* s, tgRenderTarget* dst, uint32_t* textures, uint32_t texture_count );
+
+void tgMakeReadback( tgReadback* rb, tgRenderTarget* rt );
+void tgFreeReadback( tgReadback* rb );
+
+// Starts copying the red channel of rt into rb. The copy started by the
+// previous call is written to out, rt->w * rt->h floats, once the GPU has
+// finished it. Returns 1 when out was written, 0 when the copy is still in
+// flight, in which case no new copy starts either.
+int tgReadRedChannel( tgReadback* rb, tgRenderTarget* rt, float* out );
+
 void tgMakeVertexData( tgVertexData* vd, uint32_t buffer_size, uint32_t primitive, uint32_t vertex_stride, uint32_t usage );
+// type is TG_FLOAT, TG_INT, or one of the compact formats TG_HALF, TG_UNORM8 and
+// TG_SNORM10. Shaders always see floats, so compact attributes need no shader
+// changes beyond reading a vec4 when size is 4. The packing helpers below
+// produce the compact formats.
 void tgAddAttribute( tgVertexData* vd, char* name, uint32_t size, uint32_t type, uint32_t offset );
+uint16_t tgHalf( float f );
+uint32_t tgPackUnorm8( float x, float y, float z, float w );
+uint32_t tgPackSnorm10( float x, float y, float z );
 void tgMakeRenderable( tgRenderable* r, tgVertexData* vd );
 
+// instance_data must be GL_DYNAMIC_DRAW, its buffer_size counts instances
+void tgMakeInstancedRenderable( tgRenderable* r, tgVertexData* vd, tgVertexData* instance_data );
+
 // Must be called after tgMakeRenderable
 void tgSetShader( tgRenderable* r, tgShader* s );
+void tgFreeRenderable( tgRenderable* r );
+
+// Zero-copy streaming for dynamic renderables: tgMap reserves count verts in the
+// renderable's ring buffer and returns driver memory to write them into. Once
+// written call tgUnmapRenderable, and push a draw call with null verts to draw
+// exactly the range that was mapped.
+void* tgMap( tgRenderable* r, uint32_t count );
+void tgUnmapRenderable( tgRenderable* r );
+
+// Number of times mapping this renderable's verts or instances waited on the GPU.
+// Anything above zero means the CPU ran a full three buffers ahead.
+uint32_t tgStallCount( tgRenderable* r );
+
+// Uploads the verts of a GL_STATIC_DRAW renderable right away, resizing the buffer
+// if needed. Draw calls for the renderable then never touch their verts pointer.
+// Call again whenever the verts change.
+void tgUpload( tgRenderable* r, void* verts, uint32_t count );
+
+// Uploads count indices into the verts of a renderable, after tgUpload for
+// GL_STATIC_DRAW ones so the vert count is known. Stored as 16 bit indices
+// whenever they fit. Indices of a dynamic renderable count from the first vert
+// of each draw's mapped range, and fit 16 bits when its whole ring does. Call
+// again whenever the indices change.
+void tgUploadIndices( tgRenderable* r, uint32_t* indices, uint32_t count );
 void tgLoadShader( tgShader* s, const char* vertex, const char* pixel );
 void tgFreeShader( tgShader* s );
 
@@ -209,11 +414,50 @@ void tgSendF32( tgShader* s, char* uniform_name, uint32_t size, float* floats, u
 void tgSendMatrix( tgShader* s, char* uniform_name, float* floats );
 void tgSendTexture( tgShader* s, char* uniform_name, uint32_t index );
 
+// Makes the UBO for block, attaches it to the binding point and has ctx upload
+// it whenever dirty. block->data and block->size must be set beforehand.
+void tgMakeUniformBlock( void* ctx, tgUniformBlock* block, uint32_t binding );
+void tgFreeUniformBlock( tgUniformBlock* block );
+
+// Points the shader's uniform block named block_name at block's binding point.
+// Call once after tgLoadShader.
+void tgBindUniformBlock( tgShader* s, const char* block_name, tgUniformBlock* block );
+
+// Copies size bytes to offset within the block and marks it dirty. offset is the
+// handle, e.g. TG_OFFSET_OF of the member in the caller's struct.
+void tgSetUniforms( tgUniformBlock* block, uint32_t offset, const void* data, uint32_t size );
+
 void tgPushDrawCall( void* ctx, tgDrawCall call );
 
+// Quantizes a view space depth between the near and far planes n and f into the
+// depth field of tgRenderState, nearest first. Translucent calls want back to
+// front and should store ~tgDepthKey( ... ) masked to 24 bits instead.
+uint32_t tgDepthKey( float depth, float n, float f );
+
 typedef void (*tgFunc)( );
 void tgFlush( void* ctx, tgFunc swap, tgFramebuffer* fb );
 
+// counts from the most recent tgFlush
+tgStateStats tgGetStateStats( void* ctx );
+
+// What tgFlush times with GPU timer queries. TG_GPU_TIMERS_DRAWS times each draw
+// and the post processing pass. TG_GPU_TIMERS_SCENE times all draws with a
+// single query under TG_SCENE_KEY, plus the post processing pass, for callers
+// that only need the total. Needs GL 3.3 for timer queries, otherwise timers
+// stay off.
+#define TG_GPU_TIMERS_OFF 0
+#define TG_GPU_TIMERS_DRAWS 1
+#define TG_GPU_TIMERS_SCENE 2
+void tgEnableGpuTimers( void* ctx, int mode );
+
+// Copies out up to max timings of the flush made TG_GPU_TIMER_FRAMES flushes
+// before the most recent one, in draw order. Returns how many were copied, zero
+// when that flush was not timed.
+uint32_t tgGetGpuTimes( void* ctx, tgGpuTime* times, uint32_t max );
+
+// How many timings tgGetGpuTimes has to copy out.
+uint32_t tgGetGpuTimeCount( void* ctx );
+
 void tgOrtho2D( float w, float h, float x, float y, float* m );
 void tgPerspective( float* m, float y_fov_radians, float aspect, float n, float f );
 
@@ -245,6 +489,14 @@ void tgPerspective( float* m, float y_fov_radians, float aspect, float n, float
 
 #endif
 
+typedef struct
+{
+	uint64_t key;
+	uint32_t index;
+} tgDrawKey;
+
+#define TG_MAX_UNIFORM_BLOCKS 8
+
 typedef struct
 {
 	uint32_t clear_bits;
@@ -252,6 +504,38 @@ typedef struct
 	uint32_t max_draw_calls;
 	uint32_t count;
 	tgDrawCall* calls;
+	tgDrawKey* keys;
+	tgDrawKey* scratch_keys;
+
+	// bound whenever tinygl is not drawing, so outside GL code never edits a renderable's VAO
+	uint32_t vao;
+
+	// GL state tgRender last set, forgotten at the start of every tgPresent since
+	// code outside tgPresent binds freely
+	uint32_t current_program;
+	uint32_t current_vao;
+	uint32_t active_texture;
+	uint32_t current_textures[ 8 ];
+	uint32_t current_cull;
+	tgStateStats stats;
+	tgStateStats last_stats;
+
+	// set by tgSetCulling
+	uint32_t culling;
+
+	uint32_t uniform_block_count;
+	tgUniformBlock* uniform_blocks[ TG_MAX_UNIFORM_BLOCKS ];
+
+	// GL_TIME_ELAPSED queries, timer_capacity per flush for TG_GPU_TIMER_FRAMES
+	// flushes. Each flush reads back the results of its slot before reusing it.
+	uint32_t gpu_timers;
+	uint32_t timer_capacity;
+	uint32_t gpu_frame;
+	uint32_t* queries;
+	uint64_t* query_keys;
+	uint32_t query_counts[ TG_GPU_TIMER_FRAMES ];
+	tgGpuTime* gpu_times;
+	uint32_t gpu_time_count;
 
 #if TG_LINE_RENDERER
 	tgRenderable line_r;
@@ -274,14 +558,28 @@ void* tgMakeCtx( uint32_t max_draw_calls, uint32_t clear_bits, uint32_t settings
 	ctx->max_draw_calls = max_draw_calls;
 	ctx->count = 0;
 	ctx->calls = (tgDrawCall*)malloc( sizeof( tgDrawCall ) * max_draw_calls );
-	if ( !ctx->calls )
+	ctx->keys = (tgDrawKey*)malloc( sizeof( tgDrawKey ) * max_draw_calls * 2 );
+	if ( !ctx->calls || !ctx->keys )
 	{
+		free( ctx->calls );
+		free( ctx->keys );
 		free( ctx );
 		return 0;
 	}
-	GLuint vao;
-	glGenVertexArrays( 1, &vao );
-	glBindVertexArray( vao );
+	ctx->scratch_keys = ctx->keys + max_draw_calls;
+	memset( &ctx->last_stats, 0, sizeof( ctx->last_stats ) );
+	ctx->culling = 0;
+	ctx->uniform_block_count = 0;
+	ctx->gpu_timers = 0;
+	ctx->timer_capacity = 0;
+	ctx->gpu_frame = 0;
+	ctx->queries = 0;
+	ctx->query_keys = 0;
+	memset( ctx->query_counts, 0, sizeof( ctx->query_counts ) );
+	ctx->gpu_times = 0;
+	ctx->gpu_time_count = 0;
+	glGenVertexArrays( 1, &ctx->vao );
+	glBindVertexArray( ctx->vao );
 
 #if TG_LINE_RENDERER
 	#define TG_LINE_STRIDE (sizeof( float ) * 3 * 2)
@@ -306,10 +604,24 @@ void* tgMakeCtx( uint32_t max_draw_calls, uint32_t clear_bits, uint32_t settings
 void tgFreeCtx( void* ctx )
 {
 	tgContext* context = (tgContext*)ctx;
+	glDeleteVertexArrays( 1, &context->vao );
+	if ( context->queries ) glDeleteQueries( TG_GPU_TIMER_FRAMES * context->timer_capacity, context->queries );
+	free( context->queries );
+	free( context->query_keys );
+	free( context->gpu_times );
 	free( context->calls );
+	free( context->keys );
 	free( context );
 }
 
+void tgSetCulling( void* ctx, int enabled )
+{
+	tgContext* context = (tgContext*)ctx;
+	context->culling = !!enabled;
+	if ( enabled ) glEnable( GL_CULL_FACE );
+	else glDisable( GL_CULL_FACE );
+}
+
 #if TG_LINE_RENDERER
 void tgLineMVP( void* context, float* mvp )
 {
@@ -354,6 +666,20 @@ void tgLine( void* context, float ax, float ay, float az, float bx, float by, fl
 void tgLineWidth( float width ) { TG_UNUSED( width ); }
 #endif
 
+static void tgAllocateFramebuffer( tgFramebuffer* fb, int w, int h )
+{
+	glBindTexture( GL_TEXTURE_2D, fb->tex_id );
+	glTexImage2D( GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL );
+	glBindTexture( GL_TEXTURE_2D, 0 );
+
+	glBindRenderbuffer( GL_RENDERBUFFER, fb->rb_id );
+	glRenderbufferStorage( GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, w, h );
+	glBindRenderbuffer( GL_RENDERBUFFER, 0 );
+
+	fb->w = w;
+	fb->h = h;
+}
+
 void tgMakeFramebuffer( tgFramebuffer* fb, tgShader* shader, int w, int h )
 {
 	// Generate the frame buffer
@@ -365,20 +691,22 @@ void tgMakeFramebuffer( tgFramebuffer* fb, tgShader* shader, int w, int h )
 	GLuint tex_id;
 	glGenTextures( 1, &tex_id );
 	glBindTexture( GL_TEXTURE_2D, tex_id );
-	glTexImage2D( GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL );
 	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
 	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
 	glBindTexture( GL_TEXTURE_2D, 0 );
 
-	// Attach color buffer to frame buffer
-	glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex_id, 0 );
-
 	// Generate depth and stencil attachments for the fbo using a RenderBuffer.
 	GLuint rb_id;
 	glGenRenderbuffers( 1, &rb_id );
-	glBindRenderbuffer( GL_RENDERBUFFER, rb_id );
-	glRenderbufferStorage( GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, w, h );
-	glBindRenderbuffer( GL_RENDERBUFFER, 0 );
+
+	fb->tex_id = tex_id;
+	fb->rb_id = rb_id;
+	tgAllocateFramebuffer( fb, w, h );
+
+	// Attach color and depth buffers to frame buffer
+	glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex_id, 0 );
 	glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, rb_id );
 
 	if ( glCheckFramebufferStatus( GL_FRAMEBUFFER ) != GL_FRAMEBUFFER_COMPLETE )
@@ -403,10 +731,26 @@ void tgMakeFramebuffer( tgFramebuffer* fb, tgShader* shader, int w, int h )
 	glBindBuffer( GL_ARRAY_BUFFER, 0 );
 
 	fb->fb_id = fb_id;
-	fb->tex_id = tex_id;
-	fb->rb_id = rb_id;
 	fb->quad_id = quad_id;
 	fb->shader = shader;
+	fb->scene_w = w;
+	fb->scene_h = h;
+	fb->uv_scale_location = glGetUniformLocation( shader->program, "u_uvScale" );
+}
+
+void tgResizeFramebuffer( tgFramebuffer* fb, int w, int h )
+{
+	float scale = fb->w ? (float)fb->scene_w / (float)fb->w : 1.0f;
+	tgAllocateFramebuffer( fb, w, h );
+	tgSetFramebufferScale( fb, scale );
+}
+
+void tgSetFramebufferScale( tgFramebuffer* fb, float scale )
+{
+	int w = (int)(fb->w * scale + 0.5f);
+	int h = (int)(fb->h * scale + 0.5f);
+	fb->scene_w = w < 1 ? 1 : w > fb->w ? fb->w : w;
+	fb->scene_h = h < 1 ? 1 : h > fb->h ? fb->h : h;
 }
 
 void tgFreeFramebuffer( tgFramebuffer* fb )
@@ -419,6 +763,92 @@ void tgFreeFramebuffer( tgFramebuffer* fb )
 	memset( fb, 0, sizeof( tgFramebuffer ) );
 }
 
+void tgMakeRenderTarget( tgRenderTarget* rt, int w, int h, uint32_t internal_format, const float* pixels )
+{
+	glGenTextures( 1, &rt->tex_id );
+	glBindTexture( GL_TEXTURE_2D, rt->tex_id );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+	glTexImage2D( GL_TEXTURE_2D, 0, internal_format, w, h, 0, GL_RGBA, GL_FLOAT, pixels );
+	glBindTexture( GL_TEXTURE_2D, 0 );
+
+	glGenFramebuffers( 1, &rt->fb_id );
+	glBindFramebuffer( GL_FRAMEBUFFER, rt->fb_id );
+	glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, rt->tex_id, 0 );
+
+	if ( glCheckFramebufferStatus( GL_FRAMEBUFFER ) != GL_FRAMEBUFFER_COMPLETE )
+		TG_WARN( "failed to generate render target\n" );
+
+	if ( !pixels )
+	{
+		static const float zero[ 4 ] = { 0 };
+		glClearBufferfv( GL_COLOR, 0, zero );
+	}
+
+	glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+	rt->w = w;
+	rt->h = h;
+}
+
+void tgFreeRenderTarget( tgRenderTarget* rt )
+{
+	glDeleteTextures( 1, &rt->tex_id );
+	glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+	glDeleteFramebuffers( 1, &rt->fb_id );
+	memset( rt, 0, sizeof( tgRenderTarget ) );
+}
+
+void tgMakeReadback( tgReadback* rb, tgRenderTarget* rt )
+{
+	glGenBuffers( 1, &rb->buffer );
+	glBindBuffer( GL_PIXEL_PACK_BUFFER, rb->buffer );
+	glBufferData( GL_PIXEL_PACK_BUFFER, rt->w * rt->h * sizeof( float ), NULL, GL_STREAM_READ );
+	glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+	rb->fence = 0;
+}
+
+void tgFreeReadback( tgReadback* rb )
+{
+	if ( rb->fence ) glDeleteSync( rb->fence );
+	glDeleteBuffers( 1, &rb->buffer );
+	memset( rb, 0, sizeof( tgReadback ) );
+}
+
+int tgReadRedChannel( tgReadback* rb, tgRenderTarget* rt, float* out )
+{
+	uint32_t size = rt->w * rt->h * sizeof( float );
+	int copied = 0;
+	glBindBuffer( GL_PIXEL_PACK_BUFFER, rb->buffer );
+
+	if ( rb->fence )
+	{
+		if ( glClientWaitSync( rb->fence, 0, 0 ) == GL_TIMEOUT_EXPIRED )
+		{
+			glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+			return 0;
+		}
+
+		glDeleteSync( rb->fence );
+		rb->fence = 0;
+		void* memory = glMapBufferRange( GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT );
+		if ( memory )
+		{
+			memcpy( out, memory, size );
+			glUnmapBuffer( GL_PIXEL_PACK_BUFFER );
+			copied = 1;
+		}
+	}
+
+	glBindFramebuffer( GL_READ_FRAMEBUFFER, rt->fb_id );
+	glReadPixels( 0, 0, rt->w, rt->h, GL_RED, GL_FLOAT, 0 );
+	glBindFramebuffer( GL_READ_FRAMEBUFFER, 0 );
+	glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+	rb->fence = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+	return copied;
+}
+
 static uint32_t tg_djb2( unsigned char* str )
 {
 	uint32_t hash = 5381;
@@ -474,6 +904,21 @@ static uint32_t tgGetGLType( uint32_t type )
 	}
 }
 
+// the type shaders see an attribute as, compact formats all arrive as floats
+static uint32_t tgShaderType( uint32_t type )
+{
+	switch ( type )
+	{
+	case TG_HALF:
+	case TG_UNORM8:
+	case TG_SNORM10:
+		return TG_FLOAT;
+
+	default:
+		return type;
+	}
+}
+
 void tgAddAttribute( tgVertexData* vd, char* name, uint32_t size, uint32_t type, uint32_t offset )
 {
 	tgVertexAttribute va;
@@ -487,64 +932,106 @@ void tgAddAttribute( tgVertexData* vd, char* name, uint32_t size, uint32_t type,
 	vd->attributes[ vd->attribute_count++ ] = va;
 }
 
+static void tgMakeStream( tgStream* s, uint32_t usage )
+{
+	s->index0 = 0;
+	s->index1 = 0;
+	s->buffer_number = 0;
+	s->need_new_sync = 0;
+	s->stall_count = 0;
+	memset( s->memory, 0, sizeof( s->memory ) );
+
+	if ( usage == GL_STATIC_DRAW )
+	{
+		s->buffer_count = 1;
+		s->need_new_sync = 1;
+	}
+	else s->buffer_count = 3;
+}
+
 void tgMakeRenderable( tgRenderable* r, tgVertexData* vd )
 {
 	r->data = *vd;
-	r->index0 = 0;
-	r->index1 = 0;
-	r->buffer_number = 0;
-	r->need_new_sync = 0;
 	r->program = 0;
-	r->state.key = 0;;
+	r->instanced = 0;
+	memset( r->vaos, 0, sizeof( r->vaos ) );
+	r->index_buffer = 0;
+	r->index_count = 0;
+	r->index_type = 0;
+	r->double_sided = 0;
+	tgMakeStream( &r->verts, vd->usage );
+}
 
-	if ( vd->usage == GL_STATIC_DRAW )
-	{
-		r->buffer_count = 1;
-		r->need_new_sync = 1;
-	}
-	else r->buffer_count = 3;
+void tgMakeInstancedRenderable( tgRenderable* r, tgVertexData* vd, tgVertexData* instance_data )
+{
+	// instances are streamed every frame
+	TG_ASSERT( instance_data->usage == GL_DYNAMIC_DRAW );
+
+	tgMakeRenderable( r, vd );
+	r->instanced = 1;
+	r->instance_data = *instance_data;
+	tgMakeStream( &r->instances, instance_data->usage );
 }
 
+static tgStream* tg_last_mapped;
+
 // WARNING: Messes with GL global state via glUnmapBuffer( GL_ARRAY_BUFFER ) and
 // glBindBuffer( GL_ARRAY_BUFFER, ... ), so call tgMap, fill in data, then call tgUnmap.
-void* tgMap( tgRenderable* r, uint32_t count )
+static void* tgMapStream( tgStream* s, tgVertexData* data, uint32_t count )
 {
+	tg_last_mapped = s;
+
 	// Cannot map a buffer when the buffer is too small
 	// Make your buffer is bigger or draw less data
-	TG_ASSERT( count <= r->data.buffer_size );
+	TG_ASSERT( count <= data->buffer_size );
 
-	uint32_t newIndex = r->index1 + count;
+	uint32_t newIndex = s->index1 + count;
 
-	if ( newIndex > r->data.buffer_size )
+	if ( newIndex > data->buffer_size )
 	{
 		// should never overflow a static buffer
-		TG_ASSERT( r->data.usage != GL_STATIC_DRAW );
+		TG_ASSERT( data->usage != GL_STATIC_DRAW );
 
-		++r->buffer_number;
-		r->buffer_number %= r->buffer_count;
-		GLsync fence = r->fences[ r->buffer_number ];
+		// Every draw reading the region being left has been issued already, so
+		// one fence here covers all of them
+		s->fences[ s->buffer_number ] = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+
+		++s->buffer_number;
+		s->buffer_number %= s->buffer_count;
+		GLsync fence = s->fences[ s->buffer_number ];
 
 		// Ensure buffer is not in use by GPU
 		// If we stall here we are GPU bound
-		GLenum result = glClientWaitSync( fence, 0, (GLuint64)1000000000 );
+		GLenum result = glClientWaitSync( fence, 0, 0 );
+		if ( result == GL_TIMEOUT_EXPIRED )
+		{
+			++s->stall_count;
+			result = glClientWaitSync( fence, GL_SYNC_FLUSH_COMMANDS_BIT, (GLuint64)1000000000 );
+		}
 		TG_ASSERT( result != GL_TIMEOUT_EXPIRED );
 		TG_ASSERT( result != GL_WAIT_FAILED );
 		glDeleteSync( fence );
+		s->fences[ s->buffer_number ] = 0;
 
-		r->index0 = 0;
-		r->index1 = count;
-		r->need_new_sync = 1;
+		s->index0 = 0;
+		s->index1 = count;
 	}
 
 	else
 	{
-		r->index0 = r->index1;
-		r->index1 = newIndex;
+		s->index0 = s->index1;
+		s->index1 = newIndex;
 	}
 
-	glBindBuffer( GL_ARRAY_BUFFER, r->buffers[ r->buffer_number ] );
-	uint32_t stream_size = (r->index1 - r->index0) * r->data.vertex_stride;
-	void* memory = glMapBufferRange( GL_ARRAY_BUFFER, r->index0 * r->data.vertex_stride, stream_size, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT );
+	if ( s->memory[ s->buffer_number ] )
+	{
+		// persistent and coherent, so writes need no unmap or flush
+		return (char*)s->memory[ s->buffer_number ] + s->index0 * data->vertex_stride;
+	}
+
+	glBindBuffer( GL_ARRAY_BUFFER, s->buffers[ s->buffer_number ] );
+	uint32_t stream_size = (s->index1 - s->index0) * data->vertex_stride;
+	void* memory = glMapBufferRange( GL_ARRAY_BUFFER, s->index0 * data->vertex_stride, stream_size, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT );
 
 #if TG_DEBUG_CHECKS
 	if ( !memory )
@@ -557,11 +1044,76 @@ void* tgMap( tgRenderable* r, uint32_t count )
 	return memory;
 }
 
-void tgUnmap( )
+void* tgMap( tgRenderable* r, uint32_t count )
+{
+	return tgMapStream( &r->verts, &r->data, count );
+}
+
+void* tgMapInstances( tgRenderable* r, uint32_t count )
+{
+	TG_ASSERT( r->instanced );
+	return tgMapStream( &r->instances, &r->instance_data, count );
+}
+
+static void tgUnmapStream( tgStream* s )
 {
+	if ( s->memory[ s->buffer_number ] ) return;
+	glBindBuffer( GL_ARRAY_BUFFER, s->buffers[ s->buffer_number ] );
 	glUnmapBuffer( GL_ARRAY_BUFFER );
 }
 
+// Unmaps whatever tgMap or tgMapInstances mapped last.
+void tgUnmap( )
+{
+	tgUnmapStream( tg_last_mapped );
+}
+
+void tgUnmapRenderable( tgRenderable* r )
+{
+	tgUnmapStream( &r->verts );
+}
+
+uint32_t tgStallCount( tgRenderable* r )
+{
+	uint32_t count = r->verts.stall_count;
+	if ( r->instanced ) count += r->instances.stall_count;
+	return count;
+}
+
+static void tgMakeStreamBuffers( tgStream* s, tgVertexData* data )
+{
+	uint32_t size = data->buffer_size * data->vertex_stride;
+
+#if TG_PERSISTENT_MAPPING
+	int persistent = data->usage != GL_STATIC_DRAW && GLAD_GL_ARB_buffer_storage;
+#else
+	int persistent = 0;
+#endif
+
+	for ( uint32_t i = 0; i < s->buffer_count; ++i )
+	{
+		GLuint* buffer = (GLuint*)s->buffers + i;
+
+		glGenBuffers( 1, buffer );
+		glBindBuffer( GL_ARRAY_BUFFER, *buffer );
+
+		if ( persistent )
+		{
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage( GL_ARRAY_BUFFER, size, NULL, flags );
+			s->memory[ i ] = glMapBufferRange( GL_ARRAY_BUFFER, 0, size, flags );
+			TG_ASSERT( s->memory[ i ] );
+		}
+
+		else glBufferData( GL_ARRAY_BUFFER, size, NULL, data->usage );
+
+		// only the first region is written before its fence would be placed
+		s->fences[ i ] = i ? glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 ) : 0;
+	}
+
+	glBindBuffer( GL_ARRAY_BUFFER, 0 );
+}
+
 void tgSetShader( tgRenderable* r, tgShader* program )
 {
 	// Cannot set the shader of a Renderable more than once
@@ -571,11 +1123,13 @@ void tgSetShader( tgRenderable* r, tgShader* program )
 	glGetProgramiv( program->program, GL_ACTIVE_ATTRIBUTES, (GLint*)&r->attribute_count );
 
 #if TG_DEBUG_CHECKS
-	if ( r->attribute_count != r->data.attribute_count )
+	uint32_t data_attribute_count = r->data.attribute_count;
+	if ( r->instanced ) data_attribute_count += r->instance_data.attribute_count;
+	if ( r->attribute_count != data_attribute_count )
 	{
 		TG_WARN( "Mismatch between VertexData attribute count (%d), and shader attribute count (%d).\n",
 				r->attribute_count,
-				r->data.attribute_count );
+				data_attribute_count );
 	}
 #endif
 
@@ -607,30 +1161,30 @@ void tgSetShader( tgRenderable* r, tgShader* program )
 				break;
 			}
 		}
+
+		for ( uint32_t j = 0; !a && r->instanced && j < r->instance_data.attribute_count; ++j )
+		{
+			tgVertexAttribute* b = r->instance_data.attributes + j;
+
+			if ( b->hash == hash )
+			{
+				a = b;
+				break;
+			}
+		}
 #endif
 
 		// Make sure the user did not have a mismatch between VertexData
 		// attributes and the attributes defined in the vertex shader
 		TG_ASSERT( a );
-		TG_ASSERT( a->type == type );
+		TG_ASSERT( tgShaderType( a->type ) == type );
 
 		a->location = glGetAttribLocation( program->program, buffer );
 	}
 
 	// Generate VBOs and initialize fences
-	uint32_t usage = r->data.usage;
-
-	for ( uint32_t i = 0; i < r->buffer_count; ++i )
-	{
-		GLuint* buffer = (GLuint*)r->buffers + i;
-
-		glGenBuffers( 1, buffer );
-		glBindBuffer( GL_ARRAY_BUFFER, *buffer );
-		glBufferData( GL_ARRAY_BUFFER, r->data.buffer_size * r->data.vertex_stride, NULL, usage );
-		r->fences[ i ] = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
-	}
-
-	glBindBuffer( GL_ARRAY_BUFFER, 0 );
+	tgMakeStreamBuffers( &r->verts, &r->data );
+	if ( r->instanced ) tgMakeStreamBuffers( &r->instances, &r->instance_data );
 }
 
 GLuint tgCompileShader( const char* Shader, uint32_t type )
@@ -727,12 +1281,143 @@ void tgLoadShader( tgShader* s, const char* vertex, const char* pixel )
 #endif
 }
 
+static void tgFreeStreamBuffers( tgStream* s )
+{
+	for ( uint32_t i = 0; i < s->buffer_count; ++i )
+	{
+		// deleting a buffer also drops its persistent mapping
+		glDeleteBuffers( 1, (GLuint*)s->buffers + i );
+		if ( s->fences[ i ] ) glDeleteSync( s->fences[ i ] );
+		s->memory[ i ] = 0;
+	}
+}
+
+void tgFreeRenderable( tgRenderable* r )
+{
+	for ( uint32_t i = 0; i < 3; ++i )
+		for ( uint32_t j = 0; j < 3; ++j )
+			if ( r->vaos[ i ][ j ] ) glDeleteVertexArrays( 1, &r->vaos[ i ][ j ] );
+
+	tgFreeStreamBuffers( &r->verts );
+	if ( r->instanced ) tgFreeStreamBuffers( &r->instances );
+	if ( r->index_buffer ) glDeleteBuffers( 1, &r->index_buffer );
+}
+
+void tgUpload( tgRenderable* r, void* verts, uint32_t count )
+{
+	TG_ASSERT( r->data.usage == GL_STATIC_DRAW );
+	tgStream* s = &r->verts;
+
+	// respecify the whole store, the driver orphans the old one if the GPU is still reading it
+	glBindBuffer( GL_ARRAY_BUFFER, s->buffers[ 0 ] );
+	glBufferData( GL_ARRAY_BUFFER, count * r->data.vertex_stride, verts, GL_STATIC_DRAW );
+	glBindBuffer( GL_ARRAY_BUFFER, 0 );
+
+	r->data.buffer_size = count;
+	s->index0 = 0;
+	s->index1 = count;
+	s->need_new_sync = 0;
+}
+
+void tgUploadIndices( tgRenderable* r, uint32_t* indices, uint32_t count )
+{
+	if ( !r->index_buffer )
+	{
+		glGenBuffers( 1, &r->index_buffer );
+
+		// the element buffer binding lives in the VAO, so any made so far lack it
+		for ( uint32_t i = 0; i < 3; ++i )
+			for ( uint32_t j = 0; j < 3; ++j )
+				if ( r->vaos[ i ][ j ] ) glDeleteVertexArrays( 1, &r->vaos[ i ][ j ] );
+		memset( r->vaos, 0, sizeof( r->vaos ) );
+	}
+
+	// uploaded through GL_ARRAY_BUFFER, binding GL_ELEMENT_ARRAY_BUFFER here would
+	// change whichever VAO is current
+	glBindBuffer( GL_ARRAY_BUFFER, r->index_buffer );
+
+	if ( r->data.buffer_size <= 0x10000 )
+	{
+		uint16_t* shorts = (uint16_t*)malloc( sizeof( uint16_t ) * count );
+		for ( uint32_t i = 0; i < count; ++i ) shorts[ i ] = (uint16_t)indices[ i ];
+		glBufferData( GL_ARRAY_BUFFER, sizeof( uint16_t ) * count, shorts, GL_STATIC_DRAW );
+		free( shorts );
+		r->index_type = GL_UNSIGNED_SHORT;
+	}
+
+	else
+	{
+		glBufferData( GL_ARRAY_BUFFER, sizeof( uint32_t ) * count, indices, GL_STATIC_DRAW );
+		r->index_type = GL_UNSIGNED_INT;
+	}
+
+	glBindBuffer( GL_ARRAY_BUFFER, 0 );
+	r->index_count = count;
+}
+
 void tgFreeShader( tgShader* s )
 {
 	glDeleteProgram( s->program );
 	memset( s, 0, sizeof( tgShader ) );
 }
 
+void tgMakeUniformBlock( void* ctx, tgUniformBlock* block, uint32_t binding )
+{
+	tgContext* context = (tgContext*)ctx;
+	TG_ASSERT( context->uniform_block_count < TG_MAX_UNIFORM_BLOCKS );
+	TG_ASSERT( block->data );
+	context->uniform_blocks[ context->uniform_block_count++ ] = block;
+
+	block->binding = binding;
+	glGenBuffers( 1, &block->ubo );
+	glBindBuffer( GL_UNIFORM_BUFFER, block->ubo );
+	glBufferData( GL_UNIFORM_BUFFER, block->size, block->data, GL_DYNAMIC_DRAW );
+	glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+	glBindBufferBase( GL_UNIFORM_BUFFER, binding, block->ubo );
+	block->dirty = 0;
+}
+
+void tgFreeUniformBlock( tgUniformBlock* block )
+{
+	glDeleteBuffers( 1, &block->ubo );
+	block->ubo = 0;
+}
+
+void tgBindUniformBlock( tgShader* s, const char* block_name, tgUniformBlock* block )
+{
+	GLuint index = glGetUniformBlockIndex( s->program, block_name );
+
+	if ( index == GL_INVALID_INDEX )
+	{
+		TG_WARN( "Unable to find uniform block: %s\n", block_name );
+		return;
+	}
+
+	glUniformBlockBinding( s->program, index, block->binding );
+}
+
+void tgSetUniforms( tgUniformBlock* block, uint32_t offset, const void* data, uint32_t size )
+{
+	TG_ASSERT( offset + size <= block->size );
+	memcpy( (char*)block->data + offset, data, size );
+	block->dirty = 1;
+}
+
+static void tgUploadUniformBlocks( tgContext* ctx )
+{
+	for ( uint32_t i = 0; i < ctx->uniform_block_count; ++i )
+	{
+		tgUniformBlock* block = ctx->uniform_blocks[ i ];
+		if ( !block->dirty ) continue;
+
+		glBindBuffer( GL_UNIFORM_BUFFER, block->ubo );
+		glBufferSubData( GL_UNIFORM_BUFFER, 0, block->size, block->data );
+		block->dirty = 0;
+	}
+
+	glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+}
+
 tgUniform* tgFindUniform( tgShader* s, char* name )
 {
 	uint32_t uniform_count = s->uniform_count;
@@ -836,39 +1521,78 @@ void tgSendTexture( tgShader* s, char* uniform_name, uint32_t index )
 	tgDeactivateShader( );
 }
 
-static uint32_t tgCallSortPred( tgDrawCall* a, tgDrawCall* b )
+// LSD radix sort, one byte per pass. Passes where every key has the same byte
+// are skipped, so keys that only use a few fields cost only a few passes. Stable,
+// so equal keys stay in push order. Returns whichever buffer holds the result.
+static tgDrawKey* tgRadixSort( tgDrawKey* keys, tgDrawKey* scratch, uint32_t count )
 {
-	return a->r->state.key < b->r->state.key;
-}
+	uint32_t counts[ 8 ][ 256 ];
+	memset( counts, 0, sizeof( counts ) );
 
-static void tgQSort( tgDrawCall* items, uint32_t count )
-{
-	if ( count <= 1 ) return;
+	for ( uint32_t i = 0; i < count; ++i )
+	{
+		uint64_t key = keys[ i ].key;
+		for ( uint32_t pass = 0; pass < 8; ++pass )
+			counts[ pass ][ (key >> (pass * 8)) & 0xFF ]++;
+	}
 
-	tgDrawCall pivot = items[ count - 1 ];
-	uint32_t low = 0;
-	for ( uint32_t i = 0; i < count - 1; ++i )
+	for ( uint32_t pass = 0; pass < 8; ++pass )
 	{
-		if ( tgCallSortPred( items + i, &pivot ) )
+		uint32_t* histogram = counts[ pass ];
+		uint32_t shift = pass * 8;
+		if ( histogram[ (keys[ 0 ].key >> shift) & 0xFF ] == count ) continue;
+
+		uint32_t offset = 0;
+		for ( uint32_t i = 0; i < 256; ++i )
 		{
-			tgDrawCall tmp = items[ i ];
-			items[ i ] = items[ low ];
-			items[ low ] = tmp;
-			low++;
+			uint32_t n = histogram[ i ];
+			histogram[ i ] = offset;
+			offset += n;
 		}
+
+		for ( uint32_t i = 0; i < count; ++i )
+		{
+			tgDrawKey key = keys[ i ];
+			scratch[ histogram[ (key.key >> shift) & 0xFF ]++ ] = key;
+		}
+
+		tgDrawKey* tmp = keys;
+		keys = scratch;
+		scratch = tmp;
 	}
 
-	items[ count - 1 ] = items[ low ];
-	items[ low ] = pivot;
-	tgQSort( items, low );
-	tgQSort( items + low + 1, count - 1 - low );
+	return keys;
+}
+
+uint32_t tgDepthKey( float depth, float n, float f )
+{
+	float t = (depth - n) / (f - n);
+	if ( t < 0 ) t = 0;
+	else if ( t > 1.0f ) t = 1.0f;
+	return (uint32_t)(t * (float)0xFFFFFF);
 }
 
 void tgPushDrawCall( void* ctx, tgDrawCall call )
 {
 	tgContext* context = (tgContext*)ctx;
-	TG_ASSERT( context->count < context->max_draw_calls );
-	context->calls[ context->count++ ] = call;
+	if ( context->count == context->max_draw_calls )
+	{
+		uint32_t new_cap = context->max_draw_calls ? context->max_draw_calls * 2 : 64;
+		tgDrawCall* new_calls = (tgDrawCall*)malloc( sizeof( tgDrawCall ) * new_cap );
+		tgDrawKey* new_keys = (tgDrawKey*)malloc( sizeof( tgDrawKey ) * new_cap * 2 );
+		memcpy( new_calls, context->calls, sizeof( tgDrawCall ) * context->count );
+		memcpy( new_keys, context->keys, sizeof( tgDrawKey ) * context->count );
+		free( context->calls );
+		free( context->keys );
+		context->calls = new_calls;
+		context->keys = new_keys;
+		context->scratch_keys = new_keys + new_cap;
+		context->max_draw_calls = new_cap;
+	}
+	uint32_t index = context->count++;
+	context->keys[ index ].key = call.state.key;
+	context->keys[ index ].index = index;
+	context->calls[ index ] = call;
 }
 
 uint32_t tgGetGLEnum( uint32_t type )
@@ -880,48 +1604,101 @@ uint32_t tgGetGLEnum( uint32_t type )
 		break;
 
 	case TG_INT:
+		return GL_INT;
+		break;
+
+	case TG_HALF:
+		return GL_HALF_FLOAT;
+		break;
+
+	case TG_UNORM8:
 		return GL_UNSIGNED_BYTE;
 		break;
 
+	case TG_SNORM10:
+		return GL_INT_2_10_10_10_REV;
+		break;
+
 	default:
 		TG_ASSERT( 0 );
 		return ~0;
 	}
 }
 
+static uint32_t tgIsNormalized( uint32_t type )
+{
+	return type == TG_UNORM8 || type == TG_SNORM10;
+}
+
+uint16_t tgHalf( float f )
+{
+	uint32_t x;
+	memcpy( &x, &f, sizeof( x ) );
+	uint32_t sign = (x >> 16) & 0x8000;
+	uint32_t mantissa = x & 0x7FFFFF;
+	int32_t exponent = (int32_t)((x >> 23) & 0xFF) - 127 + 15;
+
+	// inf and nan
+	if ( ((x >> 23) & 0xFF) == 0xFF ) return (uint16_t)(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+	if ( exponent >= 31 ) return (uint16_t)(sign | 0x7C00);
+
+	// denormals, rounded to nearest
+	if ( exponent <= 0 )
+	{
+		if ( exponent < -10 ) return (uint16_t)sign;
+		mantissa |= 0x800000;
+		uint32_t shift = 14 - exponent;
+		uint32_t h = mantissa >> shift;
+		if ( (mantissa >> (shift - 1)) & 1 ) ++h;
+		return (uint16_t)(sign | h);
+	}
+
+	// rounding up may carry into the exponent, which is still correct
+	uint32_t h = sign | (exponent << 10) | (mantissa >> 13);
+	if ( mantissa & 0x1000 ) ++h;
+	return (uint16_t)h;
+}
+
+static uint32_t tgQuantize( float x, float lo, float scale )
+{
+	x = x < lo ? lo : x > 1.0f ? 1.0f : x;
+	x *= scale;
+	return (uint32_t)(int32_t)(x < 0 ? x - 0.5f : x + 0.5f);
+}
+
+uint32_t tgPackUnorm8( float x, float y, float z, float w )
+{
+	return tgQuantize( x, 0, 255.0f ) | (tgQuantize( y, 0, 255.0f ) << 8) | (tgQuantize( z, 0, 255.0f ) << 16) | (tgQuantize( w, 0, 255.0f ) << 24);
+}
+
+uint32_t tgPackSnorm10( float x, float y, float z )
+{
+	uint32_t mask = 0x3FF;
+	return (tgQuantize( x, -1.0f, 511.0f ) & mask) | ((tgQuantize( y, -1.0f, 511.0f ) & mask) << 10) | ((tgQuantize( z, -1.0f, 511.0f ) & mask) << 20);
+}
+
 void tgDoMap( tgDrawCall* call, tgRenderable* render )
 {
 	uint32_t count = call->vert_count;
 	void* driver_memory = tgMap( render, count );
 	memcpy( driver_memory, call->verts, render->data.vertex_stride * count );
-	tgUnmap( );
+	tgUnmapStream( &render->verts );
 }
 
-static void tgRender( tgContext* ctx, tgDrawCall* call )
+void tgDoMapInstances( tgDrawCall* call, tgRenderable* render )
 {
-	tgRenderable* render = call->r;
-	uint32_t texture_count = call->texture_count;
-	uint32_t* textures = call->textures;
-
-	if ( render->data.usage == GL_STATIC_DRAW )
-	{
-		if ( render->need_new_sync )
-		{
-			render->need_new_sync = 0;
-			tgDoMap( call, render );
-		}
-	}
-	else tgDoMap( call, render );
+	uint32_t count = call->instance_count;
+	void* driver_memory = tgMapInstances( render, count );
+	memcpy( driver_memory, call->instances, render->instance_data.vertex_stride * count );
+	tgUnmapStream( &render->instances );
+}
 
-	tgVertexData* data = &render->data;
+static void tgBindAttributes( tgVertexData* data, uint32_t buffer, uint32_t first, uint32_t divisor )
+{
 	tgVertexAttribute* attributes = data->attributes;
 	uint32_t vertexStride = data->vertex_stride;
 	uint32_t attributeCount = data->attribute_count;
 
-	tgSetActiveShader( render->program );
-
-	uint32_t bufferNumber = render->buffer_number;
-	uint32_t buffer = render->buffers[ bufferNumber ];
 	glBindBuffer( GL_ARRAY_BUFFER, buffer );
 
 	for ( uint32_t i = 0; i < attributeCount; ++i )
@@ -931,59 +1708,260 @@ static void tgRender( tgContext* ctx, tgDrawCall* call )
 		uint32_t location = attribute->location;
 		uint32_t size = attribute->size;
 		uint32_t type = tgGetGLEnum( attribute->type );
-		uint32_t offset = attribute->offset;
+		GLboolean normalized = tgIsNormalized( attribute->type ) ? GL_TRUE : GL_FALSE;
+		size_t offset = (size_t)first * vertexStride + attribute->offset;
 
 		glEnableVertexAttribArray( location );
-		glVertexAttribPointer( location, size, type, GL_FALSE, vertexStride, (void*)((size_t)offset) );
+		glVertexAttribPointer( location, size, type, normalized, vertexStride, (void*)offset );
+		if ( divisor ) glVertexAttribDivisor( location, divisor );
 	}
 
-	for ( uint32_t i = 0; i < texture_count; ++i )
+	glBindBuffer( GL_ARRAY_BUFFER, 0 );
+}
+
+#define TG_STATE_UNKNOWN (~0u)
+
+static void tgForgetState( tgContext* ctx )
+{
+	ctx->current_program = TG_STATE_UNKNOWN;
+	ctx->current_vao = TG_STATE_UNKNOWN;
+	ctx->active_texture = TG_STATE_UNKNOWN;
+	for ( uint32_t i = 0; i < 8; ++i ) ctx->current_textures[ i ] = TG_STATE_UNKNOWN;
+	ctx->current_cull = TG_STATE_UNKNOWN;
+}
+
+static void tgUseProgram( tgContext* ctx, uint32_t program )
+{
+	if ( ctx->current_program == program )
 	{
-		uint32_t gl_id = textures[ i ];
+		ctx->stats.elided++;
+		return;
+	}
 
-		glActiveTexture( GL_TEXTURE0 + i );
-		glBindTexture( GL_TEXTURE_2D, gl_id );
+	glUseProgram( program );
+	ctx->current_program = program;
+	ctx->stats.issued++;
+}
+
+static void tgCullFace( tgContext* ctx, uint32_t cull )
+{
+	if ( ctx->current_cull == cull )
+	{
+		ctx->stats.elided++;
+		return;
+	}
+
+	if ( cull ) glEnable( GL_CULL_FACE );
+	else glDisable( GL_CULL_FACE );
+	ctx->current_cull = cull;
+	ctx->stats.issued++;
+}
+
+static void tgBindVertexArray( tgContext* ctx, uint32_t vao )
+{
+	if ( ctx->current_vao == vao )
+	{
+		ctx->stats.elided++;
+		return;
 	}
 
-	uint32_t streamOffset = render->index0;
-	uint32_t streamSize = render->index1 - streamOffset;
-	glDrawArrays( data->primitive, streamOffset, streamSize );
+	glBindVertexArray( vao );
+	ctx->current_vao = vao;
+	ctx->stats.issued++;
+}
 
-	if ( render->need_new_sync )
+static void tgBindTexture( tgContext* ctx, uint32_t unit, uint32_t id )
+{
+	if ( ctx->current_textures[ unit ] == id )
 	{
-		// @TODO: This shouldn't be called for static buffers, only needed for streaming.
-		render->fences[ bufferNumber ] = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
-		render->need_new_sync = 0;
+		ctx->stats.elided++;
+		return;
 	}
 
-	for ( uint32_t i = 0; i < attributeCount; ++i )
+	if ( ctx->active_texture != unit )
 	{
-		tgVertexAttribute* attribute = attributes + i;
+		glActiveTexture( GL_TEXTURE0 + unit );
+		ctx->active_texture = unit;
+	}
 
-		uint32_t location = attribute->location;
-		glDisableVertexAttribArray( location );
+	glBindTexture( GL_TEXTURE_2D, id );
+	ctx->current_textures[ unit ] = id;
+	ctx->stats.issued++;
+}
+
+// Binds the VAO for the renderable's current vert and instance buffers, making
+// it on first use. Instance attributes are only re-pointed when this draw's
+// instances start somewhere else in the ring than last time.
+static void tgBindRenderable( tgContext* ctx, tgRenderable* render )
+{
+	tgStream* verts = &render->verts;
+	tgStream* instances = &render->instances;
+	uint32_t v = verts->buffer_number;
+	uint32_t i = render->instanced ? instances->buffer_number : 0;
+	uint32_t* vao = &render->vaos[ v ][ i ];
+	int fresh = !*vao;
+
+	if ( fresh )
+	{
+		glGenVertexArrays( 1, vao );
+		tgBindVertexArray( ctx, *vao );
+		tgBindAttributes( &render->data, verts->buffers[ v ], 0, 0 );
+		if ( render->index_buffer ) glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, render->index_buffer );
 	}
 
-	glBindBuffer( GL_ARRAY_BUFFER, 0 );
-	glUseProgram( 0 );
+	else tgBindVertexArray( ctx, *vao );
+
+	if ( !render->instanced ) return;
+
+	uint32_t* first = &render->vao_first_instance[ v ][ i ];
+	if ( !fresh && *first == instances->index0 )
+	{
+		ctx->stats.elided++;
+		return;
+	}
+
+	tgBindAttributes( &render->instance_data, instances->buffers[ i ], instances->index0, 1 );
+	*first = instances->index0;
+	ctx->stats.issued++;
+}
+
+static void tgRender( tgContext* ctx, tgDrawCall* call )
+{
+	tgRenderable* render = call->r;
+	uint32_t texture_count = call->texture_count;
+	uint32_t* textures = call->textures;
+
+	tgStream* verts = &render->verts;
+
+	if ( render->data.usage == GL_STATIC_DRAW )
+	{
+		if ( verts->need_new_sync )
+		{
+			verts->need_new_sync = 0;
+			tgDoMap( call, render );
+		}
+	}
+	else if ( call->verts ) tgDoMap( call, render );
+
+	if ( render->instanced ) tgDoMapInstances( call, render );
+
+	tgVertexData* data = &render->data;
+
+	tgUseProgram( ctx, render->program->program );
+	tgBindRenderable( ctx, render );
+
+	for ( uint32_t i = 0; i < texture_count; ++i )
+		tgBindTexture( ctx, i, textures[ i ] );
+
+	tgCullFace( ctx, ctx->culling && !render->double_sided );
+
+	uint32_t streamOffset = verts->index0;
+	uint32_t streamSize = verts->index1 - streamOffset;
+
+	if ( render->index_count )
+	{
+		// static verts start at zero, streamed ones wherever this draw's range is
+		if ( render->instanced ) glDrawElementsInstancedBaseVertex( data->primitive, render->index_count, render->index_type, 0, call->instance_count, streamOffset );
+		else glDrawElementsBaseVertex( data->primitive, render->index_count, render->index_type, 0, streamOffset );
+	}
+
+	else if ( render->instanced ) glDrawArraysInstanced( data->primitive, streamOffset, streamSize, call->instance_count );
+	else glDrawArrays( data->primitive, streamOffset, streamSize );
+}
+
+// Makes room for capacity queries per flush. Queries still in flight keep their
+// place at the start of their slot, so they are read back as usual.
+static void tgGrowGpuTimers( tgContext* ctx, uint32_t capacity )
+{
+	uint32_t old_cap = ctx->timer_capacity;
+	uint32_t* queries = (uint32_t*)malloc( sizeof( uint32_t ) * TG_GPU_TIMER_FRAMES * capacity );
+	uint64_t* query_keys = (uint64_t*)malloc( sizeof( uint64_t ) * TG_GPU_TIMER_FRAMES * capacity );
+	for ( uint32_t slot = 0; slot < TG_GPU_TIMER_FRAMES; ++slot )
+	{
+		if ( old_cap )
+		{
+			memcpy( queries + slot * capacity, ctx->queries + slot * old_cap, sizeof( uint32_t ) * old_cap );
+			memcpy( query_keys + slot * capacity, ctx->query_keys + slot * old_cap, sizeof( uint64_t ) * old_cap );
+		}
+		glGenQueries( capacity - old_cap, queries + slot * capacity + old_cap );
+	}
+	free( ctx->queries );
+	free( ctx->query_keys );
+	ctx->queries = queries;
+	ctx->query_keys = query_keys;
+	ctx->gpu_times = (tgGpuTime*)realloc( ctx->gpu_times, sizeof( tgGpuTime ) * capacity );
+	ctx->timer_capacity = capacity;
+}
+
+// Reads back the queries of the flush TG_GPU_TIMER_FRAMES ago, whose slot this
+// flush is about to reuse.
+static void tgCollectGpuTimes( tgContext* ctx )
+{
+	ctx->gpu_time_count = 0;
+	if ( !ctx->gpu_timers ) return;
+
+	uint32_t slot = ctx->gpu_frame % TG_GPU_TIMER_FRAMES;
+	uint32_t first = slot * ctx->timer_capacity;
+	for ( uint32_t i = 0; i < ctx->query_counts[ slot ]; ++i )
+	{
+		GLuint64 ns = 0;
+		glGetQueryObjectui64v( ctx->queries[ first + i ], GL_QUERY_RESULT, &ns );
+		ctx->gpu_times[ i ].key = ctx->query_keys[ first + i ];
+		ctx->gpu_times[ i ].nanoseconds = ns;
+	}
+
+	ctx->gpu_time_count = ctx->query_counts[ slot ];
+	ctx->query_counts[ slot ] = 0;
+}
+
+// GL_TIME_ELAPSED queries cannot nest, so only one draw is timed at a time
+static void tgBeginGpuTimer( tgContext* ctx, uint64_t key )
+{
+	if ( !ctx->gpu_timers ) return;
+
+	uint32_t slot = ctx->gpu_frame % TG_GPU_TIMER_FRAMES;
+	uint32_t index = slot * ctx->timer_capacity + ctx->query_counts[ slot ]++;
+	ctx->query_keys[ index ] = key;
+	glBeginQuery( GL_TIME_ELAPSED, ctx->queries[ index ] );
+}
+
+static void tgEndGpuTimer( tgContext* ctx )
+{
+	if ( ctx->gpu_timers ) glEndQuery( GL_TIME_ELAPSED );
 }
 
 void tgPresent( void* context, tgFramebuffer* fb )
 {
 	tgContext* ctx = (tgContext*)context;
-	tgQSort( ctx->calls, ctx->count );
+	tgDrawKey* keys = ctx->count ? tgRadixSort( ctx->keys, ctx->scratch_keys, ctx->count ) : ctx->keys;
 
-	if ( fb ) glBindFramebuffer( GL_FRAMEBUFFER, fb->fb_id );
+	if ( fb )
+	{
+		glBindFramebuffer( GL_FRAMEBUFFER, fb->fb_id );
+		glViewport( 0, 0, fb->scene_w, fb->scene_h );
+	}
 	if ( ctx->clear_bits ) glClear( ctx->clear_bits );
 	if ( ctx->settings_bits ) glEnable( ctx->settings_bits );
 
+	tgForgetState( ctx );
+	memset( &ctx->stats, 0, sizeof( ctx->stats ) );
+	tgUploadUniformBlocks( ctx );
+	tgCollectGpuTimes( ctx );
+	int time_draws = ctx->gpu_timers == TG_GPU_TIMERS_DRAWS;
+	if ( time_draws && ctx->count + 1 > ctx->timer_capacity ) tgGrowGpuTimers( ctx, ctx->max_draw_calls + 1 );
+	if ( ctx->gpu_timers == TG_GPU_TIMERS_SCENE ) tgBeginGpuTimer( ctx, TG_SCENE_KEY );
+
 	// flush all draw calls to the GPU
 	for ( uint32_t i = 0; i < ctx->count; ++i )
 	{
-		tgDrawCall* call = ctx->calls + i;
+		tgDrawCall* call = ctx->calls + keys[ i ].index;
+		if ( time_draws ) tgBeginGpuTimer( ctx, call->state.key );
 		tgRender( ctx, call );
+		if ( time_draws ) tgEndGpuTimer( ctx );
 	}
 
+	if ( ctx->gpu_timers == TG_GPU_TIMERS_SCENE ) tgEndGpuTimer( ctx );
+
 #if TG_LINE_RENDERER
 	if ( ctx->line_vert_count )
 	{
@@ -991,20 +1969,33 @@ void tgPresent( void* context, tgFramebuffer* fb )
 		tgDrawCall call;
 		call.vert_count = ctx->line_vert_count;
 		call.verts = ctx->line_verts;
+		call.instance_count = 0;
+		call.instances = 0;
 		call.r = &ctx->line_r;
+		call.state.key = 0;
 		call.texture_count = 0;
 		tgRender( ctx, &call );
 		ctx->line_vert_count = 0;
 	}
 #endif
 
+	// hand GL back the way tgRender used to leave it after every draw
+	glBindVertexArray( ctx->vao );
+	glUseProgram( 0 );
+	if ( ctx->active_texture != TG_STATE_UNKNOWN && ctx->active_texture ) glActiveTexture( GL_TEXTURE0 );
+	if ( ctx->current_cull != TG_STATE_UNKNOWN && ctx->current_cull != ctx->culling ) tgSetCulling( ctx, ctx->culling );
+	ctx->last_stats = ctx->stats;
+
 	if ( fb )
 	{
 		glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+		glViewport( 0, 0, fb->w, fb->h );
 		glClear( GL_COLOR_BUFFER_BIT );
 		glDisable( GL_DEPTH_TEST );
 
+		tgBeginGpuTimer( ctx, TG_POST_FX_KEY );
 		tgSetActiveShader( fb->shader );
+		glUniform2f( fb->uv_scale_location, (float)fb->scene_w / (float)fb->w, (float)fb->scene_h / (float)fb->h );
 		glBindBuffer( GL_ARRAY_BUFFER, fb->quad_id );
 		glBindTexture( GL_TEXTURE_2D, fb->tex_id );
 		glEnableVertexAttribArray( 0 );
@@ -1014,7 +2005,32 @@ void tgPresent( void* context, tgFramebuffer* fb )
 		glDrawArrays( GL_TRIANGLES, 0, 6 );
 		glBindBuffer( GL_ARRAY_BUFFER, 0 );
 		tgDeactivateShader( );
+		tgEndGpuTimer( ctx );
+	}
+
+	if ( ctx->gpu_timers ) ctx->gpu_frame++;
+}
+
+void tgRunPass( void* context, tgShader* s, tgRenderTarget* dst, uint32_t* textures, uint32_t texture_count )
+{
+	tgContext* ctx = (tgContext*)context;
+	glBindFramebuffer( GL_FRAMEBUFFER, dst->fb_id );
+	glViewport( 0, 0, dst->w, dst->h );
+	glUseProgram( s->program );
+
+	for ( uint32_t i = 0; i < texture_count; ++i )
+	{
+		glActiveTexture( GL_TEXTURE0 + i );
+		glBindTexture( GL_TEXTURE_2D, textures[ i ] );
 	}
+	if ( texture_count > 1 ) glActiveTexture( GL_TEXTURE0 );
+
+	// the target has no depth buffer, so depth testing never rejects anything
+	glBindVertexArray( ctx->vao );
+	glDrawArrays( GL_TRIANGLES, 0, 3 );
+
+	glUseProgram( 0 );
+	glBindFramebuffer( GL_FRAMEBUFFER, 0 );
 }
 
 void tgFlush( void* ctx, tgFunc swap, tgFramebuffer* fb )
@@ -1026,6 +2042,41 @@ void tgFlush( void* ctx, tgFunc swap, tgFramebuffer* fb )
 	swap( );
 }
 
+void tgEnableGpuTimers( void* ctx, int mode )
+{
+	tgContext* context = (tgContext*)ctx;
+	if ( !GLAD_GL_VERSION_3_3 ) mode = TG_GPU_TIMERS_OFF;
+
+	// a scene and a post processing query per flush, draws grow it as needed
+	uint32_t capacity = mode == TG_GPU_TIMERS_DRAWS ? context->max_draw_calls + 1 : 2;
+	if ( mode && context->timer_capacity < capacity ) tgGrowGpuTimers( context, capacity );
+
+	// results still in flight are dropped rather than read back later
+	if ( mode != context->gpu_timers ) memset( context->query_counts, 0, sizeof( context->query_counts ) );
+	context->gpu_timers = mode;
+	context->gpu_time_count = 0;
+}
+
+uint32_t tgGetGpuTimes( void* ctx, tgGpuTime* times, uint32_t max )
+{
+	tgContext* context = (tgContext*)ctx;
+	uint32_t count = context->gpu_time_count < max ? context->gpu_time_count : max;
+	memcpy( times, context->gpu_times, sizeof( tgGpuTime ) * count );
+	return count;
+}
+
+uint32_t tgGetGpuTimeCount( void* ctx )
+{
+	tgContext* context = (tgContext*)ctx;
+	return context->gpu_time_count;
+}
+
+tgStateStats tgGetStateStats( void* ctx )
+{
+	tgContext* context = (tgContext*)ctx;
+	return context->last_stats;
+}
+
 #include <math.h>
 
 void tgPerspective( float* m, float y_fov_radians, float aspect, float n, float f )
@@ -1272,6 +1272,8 @@ void tsMix( tsContext* ctx )
 	  3. This notice may not be removed or altered from any source distribution.
 */
 
+#ifdef TS_IMPLEMENTATION
+
 // NOTE:
 // See FAQ and see docs for tsPitchShift for more information on the below code.
 // Feel free to remove the below code in order to get rid of the WOL license,
@@ -1548,4 +1550,6 @@ static void smbPitchShift(float pitchShift, long numSampsToProcess, float sample
 			for (k = 0; k < inFifoLatency; k++) pf->gInFIFO[k] = pf->gInFIFO[k+stepSize];
 		}
 	}
-}
\ No newline at end of file
+}
+
+#endif // TS_IMPLEMENTATION